@@ -9,49 +9,484 @@
 #ifndef __FIFOBUFF_HPP__
 #define __FIFOBUFF_HPP__
 
+#include <stddef.h>
 #include <stdint.h>
-#include <semaphore.h>
 #include <pthread.h>
+#include <sched.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Size of a cache line, used to keep indices written by different threads apart.
+ */
+#ifndef FIFOBUFF_CACHE_LINE
+#define FIFOBUFF_CACHE_LINE 64
+#endif
+
+/*
+ * FIFO Capacity Policy
+ *
+ * Supplies the capacity of a FIFOBuff and how ring indices wrap around.  When
+ * 'N' is non-zero, the capacity is fixed at compile-time and must be a power of
+ * two so wrap-around is a mask instead of an integer division.  A capacity
+ * passed to the constructor must then equal 'N', or std::invalid_argument is
+ * thrown (indexing would otherwise run past a smaller buffer).
+ * param N: compile-time capacity, or 0 for a capacity given at run-time.
+ */
+template <size_t N>
+class FIFOCap {
+    static_assert((N & (N - 1)) == 0, "FIFOBuff compile-time capacity must be a power of two");
+
+protected:
+
+    FIFOCap(size_t max_cap) {
+        if (max_cap != N) {
+            throw std::invalid_argument("FIFOBuff capacity must equal the compile-time capacity");
+        }
+    }
+
+    size_t cap() const {
+        return N;
+    }
+
+    size_t wrap(size_t idx) const {
+        return idx & (N - 1);
+    }
+};
+
+/*
+ * Capacity given at run-time; wrap-around is done by modulo.
+ */
+template <>
+class FIFOCap<0> {
+    size_t      fifo_cap;
+
+protected:
+
+    FIFOCap(size_t max_cap) : fifo_cap(max_cap) {
+    }
+
+    size_t cap() const {
+        return fifo_cap;
+    }
+
+    size_t wrap(size_t idx) const {
+        return idx % fifo_cap;
+    }
+};
+
+/*
+ * Where a FIFOBuff keeps its elements.
+ */
+enum FIFOStorage {
+    FIFO_USER,          // Memory provided by caller.
+    FIFO_HEAP,          // Allocated with new[].
+    FIFO_MIRRORED       // Pages mapped twice, back-to-back (Linux only).
+};
+
+/*
+ * Maps 'bytes' (a multiple of the page size) of memfd-backed memory twice,
+ * back-to-back, so that writing past the end of the first mapping writes to the
+ * start of the buffer.
+ *
+ * return: Returns the start of the first mapping or null on failure.
+ */
+inline void *fifo_mirror_map(size_t bytes) {
+#ifdef __linux__
+    int     fd;
+    uint8_t *base;
+
+    if (bytes == 0 || bytes % sysconf(_SC_PAGESIZE) != 0) {
+        return nullptr;
+    }
+
+    fd = memfd_create("FIFOBuff", MFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    /*
+     * Reserve address space for both copies, then map the memfd over each half.
+     */
+    base = static_cast<uint8_t*>(mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+    if (base == MAP_FAILED || ftruncate(fd, bytes) != 0 ||
+            mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        if (base != MAP_FAILED) {
+            munmap(base, 2 * bytes);
+        }
+
+        close(fd);
+        return nullptr;
+    }
+
+    // The mappings keep the memory alive.
+    close(fd);
+
+    return base;
+#else
+    (void)bytes;
+    return nullptr;
+#endif
+}
+
+inline void fifo_mirror_unmap(void *base, size_t bytes) {
+    munmap(base, 2 * bytes);
+}
+
+/*
+ * Counters returned by 'stats()' on a FIFOBuff or FIFOBuff_TS.  All zero unless
+ * the FIFO was built with the FIFOStats policy.
+ */
+struct FIFOStatsData {
+    uint64_t    adds;               // Elements added.
+    uint64_t    removes;            // Elements removed.
+    uint64_t    full;               // Adds rejected (or cut short) because the FIFO was full.
+    uint64_t    empty;              // Removes that found the FIFO empty.
+    uint64_t    evicted;            // Elements evicted to make room ('add_overwrite()', FIFODropOldest),
+                                    // or dropped by FIFOBuff_TS's dequeue hook.
+    uint64_t    high_water;         // Most elements in the FIFO at once.
+    uint64_t    add_blocks;         // Blocking adds that had to wait (FIFOBuff_TS).
+    uint64_t    add_blocked_ns;     // Time they waited.
+    uint64_t    remove_blocks;      // Blocking removes that had to wait (FIFOBuff_TS).
+    uint64_t    remove_blocked_ns;  // Time they waited.
+};
+
+/*
+ * FIFO Statistics Policies
+ *
+ * Passed as the 'Stats' template parameter of FIFOBuff and FIFOBuff_TS, which
+ * call these hooks as elements come and go.  FIFONoStats (the default) is empty
+ * and its hooks do nothing, so it compiles away entirely.  FIFOStats counts.
+ */
+struct FIFONoStats {
+    static const bool enabled = false;
+
+    void count_add(size_t, size_t) {}
+    void count_remove(size_t) {}
+    void count_full() {}
+    void count_empty() {}
+    void count_evict() {}
+    void count_add_blocked(uint64_t) {}
+    void count_remove_blocked(uint64_t) {}
+
+    FIFOStatsData read() const {
+        return FIFOStatsData();
+    }
+
+    void reset() {}
+};
+
+/*
+ * Adds and removes are counted by the thread doing them while it has the FIFO to
+ * itself (in FIFOBuff_TS, under its lock), so those counters are updated with
+ * plain relaxed loads and stores.  Full/empty misses and blocked time happen
+ * outside the lock and use relaxed atomic adds; those are the slow paths.  Any
+ * thread may call 'stats()'.
+ */
+class FIFOStats {
+    std::atomic<uint64_t>   adds;
+    std::atomic<uint64_t>   removes;
+    std::atomic<uint64_t>   high_water;
+    std::atomic<uint64_t>   full;
+    std::atomic<uint64_t>   empty;
+    std::atomic<uint64_t>   evicted;
+    std::atomic<uint64_t>   add_blocks;
+    std::atomic<uint64_t>   add_blocked_ns;
+    std::atomic<uint64_t>   remove_blocks;
+    std::atomic<uint64_t>   remove_blocked_ns;
+
+    static void bump(std::atomic<uint64_t> &cnt, uint64_t n) {
+        cnt.store(cnt.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+public:
+    static const bool enabled = true;
+
+    FIFOStats() {
+        reset();
+    }
+
+    void count_add(size_t n, size_t occupancy) {
+        bump(adds, n);
+
+        if (occupancy > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(occupancy, std::memory_order_relaxed);
+        }
+    }
+
+    void count_remove(size_t n) {
+        bump(removes, n);
+    }
+
+    void count_full() {
+        full.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_empty() {
+        empty.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_evict() {
+        bump(evicted, 1);
+    }
+
+    void count_add_blocked(uint64_t ns) {
+        add_blocks.fetch_add(1, std::memory_order_relaxed);
+        add_blocked_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    void count_remove_blocked(uint64_t ns) {
+        remove_blocks.fetch_add(1, std::memory_order_relaxed);
+        remove_blocked_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    FIFOStatsData read() const {
+        FIFOStatsData   d;
+
+        d.adds = adds.load(std::memory_order_relaxed);
+        d.removes = removes.load(std::memory_order_relaxed);
+        d.full = full.load(std::memory_order_relaxed);
+        d.empty = empty.load(std::memory_order_relaxed);
+        d.evicted = evicted.load(std::memory_order_relaxed);
+        d.high_water = high_water.load(std::memory_order_relaxed);
+        d.add_blocks = add_blocks.load(std::memory_order_relaxed);
+        d.add_blocked_ns = add_blocked_ns.load(std::memory_order_relaxed);
+        d.remove_blocks = remove_blocks.load(std::memory_order_relaxed);
+        d.remove_blocked_ns = remove_blocked_ns.load(std::memory_order_relaxed);
+
+        return d;
+    }
+
+    /*
+     * Zeroes the counters.  Counts made while this runs may be lost.
+     */
+    void reset() {
+        adds.store(0, std::memory_order_relaxed);
+        removes.store(0, std::memory_order_relaxed);
+        full.store(0, std::memory_order_relaxed);
+        empty.store(0, std::memory_order_relaxed);
+        evicted.store(0, std::memory_order_relaxed);
+        high_water.store(0, std::memory_order_relaxed);
+        add_blocks.store(0, std::memory_order_relaxed);
+        add_blocked_ns.store(0, std::memory_order_relaxed);
+        remove_blocks.store(0, std::memory_order_relaxed);
+        remove_blocked_ns.store(0, std::memory_order_relaxed);
+    }
+};
 
 /*
  * FIFO Buffer Class
  *
  * Implements a non-thread-safe, fixed-sized, FIFO buffer.
  * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity of the FIFO fixed at compile-time (must be a
+ *          power of two).  If zero (default), capacity is passed to the constructor.
+ * param Stats: FIFONoStats (default) or FIFOStats to keep counters (see 'stats()').
  */
-template <typename T>
-class FIFOBuff {
+template <typename T, size_t N = 0, typename Stats = FIFONoStats>
+class FIFOBuff : private FIFOCap<N>, private Stats {
     typedef uint8_t item_mem_t[sizeof(T)];
+    typedef std::is_trivially_copyable<T> trivial_t;
 
     item_mem_t  *buffer;
     size_t      head;
     size_t      tail;
     size_t      fifo_size;
-    size_t      fifo_cap;
-    bool        free_mem;
+    FIFOStorage storage;
+
+    /*
+     * Rounds 'max_cap' up so the buffer fills whole pages, as mirrored storage
+     * requires.  A capacity fixed at compile-time can't be changed.
+     */
+    static size_t mirror_cap(size_t max_cap) {
+        size_t  page = sysconf(_SC_PAGESIZE);
+        size_t  a = page;
+        size_t  b = sizeof(T);
+        size_t  unit;
+
+        // The fewest elements that fill whole pages is page / gcd(page, sizeof(T)).
+        while (b != 0) {
+            size_t  r = a % b;
+
+            a = b;
+            b = r;
+        }
+
+        unit = page / a;
+
+        return N != 0 ? N : (max_cap + unit - 1) / unit * unit;
+    }
+
+    /*
+     * Returns the number of slots that are contiguous in memory starting at 'idx'.
+     * With mirrored storage, a run of up to 'capacity()' slots is always contiguous.
+     */
+    size_t contig(size_t idx) const {
+        return storage == FIFO_MIRRORED ? this->cap() : this->cap() - idx;
+    }
+
+    /*
+     * Copy 'n' elements from 'src' into contiguous, unused slots at 'dst'.
+     */
+    static void copy_in(item_mem_t *dst, const T *src, size_t n, std::true_type) {
+        if (n > 0) {
+            memcpy(dst, src, n * sizeof(T));
+        }
+    }
+
+    static void copy_in(item_mem_t *dst, const T *src, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; i++) {
+            new (dst + i) T(src[i]);
+        }
+    }
+
+    /*
+     * Move 'n' elements out of contiguous slots at 'src' into 'dst' (if not null)
+     * and destroy them.
+     */
+    static void move_out(T *dst, item_mem_t *src, size_t n, std::true_type) {
+        if (dst != nullptr && n > 0) {
+            memcpy(dst, src, n * sizeof(T));
+        }
+    }
+
+    static void move_out(T *dst, item_mem_t *src, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; i++) {
+            T   *pitem = reinterpret_cast<T*>(src + i);
+
+            if (dst != nullptr) {
+                dst[i] = std::move(*pitem);
+            }
+
+            pitem->~T();
+        }
+    }
+
+    template <typename U>
+    bool put_overwrite(U &&item) {
+        if (fifo_size < this->cap()) {
+            emplace(std::forward<U>(item));
+
+            return false;
+        }
+
+        // Full, so the oldest element is in the slot being added to.
+        *reinterpret_cast<T*>(buffer + tail) = std::forward<U>(item);
+        head = tail = this->wrap(tail + 1);
+        this->count_evict();
+        this->count_add(1, fifo_size);
+
+        return true;
+    }
 
 public:
 
-    FIFOBuff() = delete;
+    /*
+     * A run of contiguous elements (or unused slots) in the FIFO buffer.
+     */
+    struct span_t {
+        T       *ptr;
+        size_t  len;
+    };
+
+    /*
+     * A run of elements that may wrap around the end of the FIFO buffer.  'second'
+     * is empty (len of 0) unless the run wraps.
+     */
+    struct span_pair_t {
+        span_t  first;
+        span_t  second;
+
+        size_t size() const {
+            return first.len + second.len;
+        }
+    };
+
+    /*
+     * Construct a FIFO buffer with a dynamically allocated buffer that can
+     * contain 'N' elements.  Only available when capacity is fixed at compile-time.
+     */
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff() : FIFOCap<N>(N), head(0), tail(0), fifo_size(0), storage(FIFO_HEAP) {
+        buffer = new item_mem_t[N];
+    }
+
+    /*
+     * Construct a FIFO buffer using memory provided by caller that can contain
+     * 'N' elements.  Only available when capacity is fixed at compile-time.
+     *
+     * param buf: Pointer to buffer memory of at least "sizeof(T) * N" bytes.
+     */
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    explicit FIFOBuff(void *buf) : FIFOCap<N>(N), head(0), tail(0), fifo_size(0), storage(FIFO_USER) {
+        buffer = reinterpret_cast<item_mem_t*>(buf);
+    }
 
     /*
      * Construct a FIFO buffer with a dynamically allocated buffer that can
      * contain a max of 'fifo_size' elements.
      *
-     * param fifo_size: Max number of elements FIFO can hold.
+     * param fifo_size: Max number of elements FIFO can hold.  Must equal 'N' if
+     *        capacity is fixed at compile-time (std::invalid_argument is thrown
+     *        otherwise).
+     */
+    FIFOBuff(size_t max_cap) : FIFOCap<N>(max_cap), head(0), tail(0), fifo_size(0), storage(FIFO_HEAP) {
+        buffer = new item_mem_t[this->cap()];
+    }
+
+    /*
+     * Construct a FIFO buffer that allocates its buffer using 'storage'.
+     *
+     * With FIFO_MIRRORED, the buffer's pages are mapped twice, back-to-back, so any
+     * run of up to 'capacity()' elements is contiguous in memory: bulk operations
+     * never split at the wrap point and 'data()'/'prepare()' return a single span.
+     * The capacity is rounded up so the buffer fills whole pages (a capacity fixed
+     * at compile-time must already do so).  If the mapping can't be made, the
+     * buffer falls back to FIFO_HEAP; see 'mirrored()'.
+     *
+     * param max_cap: Max number of elements FIFO can hold (before rounding).
+     * param storage: FIFO_HEAP or FIFO_MIRRORED.
      */
-    FIFOBuff(size_t max_cap) : head(0), tail(0), fifo_size(0), fifo_cap(max_cap), free_mem(true) {
-        buffer = new item_mem_t[fifo_cap];
+    FIFOBuff(size_t max_cap, FIFOStorage storage) :
+            FIFOCap<N>(storage == FIFO_MIRRORED ? mirror_cap(max_cap) : max_cap),
+            head(0), tail(0), fifo_size(0), storage(storage) {
+        buffer = nullptr;
+
+        if (storage == FIFO_MIRRORED) {
+            buffer = static_cast<item_mem_t*>(fifo_mirror_map(this->cap() * sizeof(T)));
+        }
+
+        if (buffer == nullptr) {
+            this->storage = FIFO_HEAP;
+            buffer = new item_mem_t[this->cap()];
+        }
     }
 
     /*
      * Construct a FIFO buffer using memory provided by caller.
      *
      * param buf: Pointer to buffer memory of at least "sizeof(T) * fifo_size" bytes.
-     * param fifo_size: max number of elements FIFO can hold.
+     * param fifo_size: max number of elements FIFO can hold.  Must equal 'N' if
+     *        capacity is fixed at compile-time, as for 'FIFOBuff(size_t)'.
      */
-    FIFOBuff(void *buf, size_t max_cap) : head(0), tail(0), fifo_size(0), fifo_cap(max_cap), free_mem(false) {
+    FIFOBuff(void *buf, size_t max_cap) : FIFOCap<N>(max_cap), head(0), tail(0), fifo_size(0), storage(FIFO_USER) {
         buffer = reinterpret_cast<item_mem_t*>(buf);
     }
 
@@ -61,13 +496,16 @@ public:
          */
         while (fifo_size > 0) {
             reinterpret_cast<T*>(buffer + head)->~T();
-            head = (head + 1) % fifo_cap;
+            head = this->wrap(head + 1);
             fifo_size--;
         }
 
-        if (free_mem) {
+        if (storage == FIFO_HEAP) {
             delete [] buffer;
         }
+        else if (storage == FIFO_MIRRORED) {
+            fifo_mirror_unmap(buffer, this->cap() * sizeof(T));
+        }
     }
 
     /*
@@ -81,7 +519,14 @@ public:
      * Returns max number of elements FIFO can hold.
      */
     size_t capacity() const {
-        return fifo_cap;
+        return this->cap();
+    }
+
+    /*
+     * Returns true if the FIFO buffer is mirrored (see FIFO_MIRRORED).
+     */
+    bool mirrored() const {
+        return storage == FIFO_MIRRORED;
     }
 
     /*
@@ -91,161 +536,1666 @@ public:
      * @return Returns true if 'item' was added, false if FIFO was full.
      */
     bool add(const T &item) {
-        if (fifo_size < fifo_cap) {
-            new (buffer + tail) T(item);
-            tail = (tail + 1) % fifo_cap;
+        return emplace(item);
+    }
+
+    /*
+     * Same as above, but moves 'item' into the FIFO buffer.
+     */
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    /*
+     * Adds element to the back of the FIFO by constructing it in place from 'args'.
+     *
+     * @return Returns true if the element was added, false if FIFO was full.
+     */
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (fifo_size < this->cap()) {
+            new (buffer + tail) T(std::forward<Args>(args)...);
+            tail = this->wrap(tail + 1);
             fifo_size++;
+            this->count_add(1, fifo_size);
 
             return true;
         }
         else {
+            this->count_full();
+
             return false;
         }
     }
 
+    /*
+     * Same as 'add()', except when the FIFO is full the oldest element is evicted
+     * to make room, in the same call.  Use it to keep the most recent 'capacity()'
+     * elements, e.g. telemetry samples.  The new element is assigned over the
+     * evicted one, so e.g. a std::string reuses its memory.  With the FIFOStats
+     * policy, evictions are counted in 'stats()'.
+     *
+     * @return Returns true if an element was evicted.
+     */
+    bool add_overwrite(const T &item) {
+        return put_overwrite(item);
+    }
+
+    bool add_overwrite(T &&item) {
+        return put_overwrite(std::move(item));
+    }
+
+    /*
+     * Same as 'add_overwrite()', but the evicted element is destroyed and the new
+     * one constructed in place from 'args'.
+     */
+    template <typename... Args>
+    bool emplace_overwrite(Args&&... args) {
+        bool    full = fifo_size == this->cap();
+
+        if (full) {
+            reinterpret_cast<T*>(buffer + head)->~T();
+            head = this->wrap(head + 1);
+            fifo_size--;
+            this->count_evict();
+        }
+
+        emplace(std::forward<Args>(args)...);
+
+        return full;
+    }
+
+    /*
+     * Returns the counters kept with the FIFOStats policy (all zero otherwise).
+     * 'full' counts failed 'add()' calls and 'add_n()' calls cut short; 'empty'
+     * counts 'remove()'/'remove_n()' calls that found nothing.
+     */
+    FIFOStatsData stats() const {
+        return Stats::read();
+    }
+
+    void reset_stats() {
+        Stats::reset();
+    }
+
     /**
      * Removes the item at the head of the FIFO.
      *
-     * @param pitem If not null, the element being removed is copied to 'pitem' before
+     * @param pitem If not null, the element being removed is moved to 'pitem' before
      *        removal.
      * @return returns true if an element was removed, false if FIFO was empty.
      */
     bool remove(T *pitem) {
         if (fifo_size == 0) {
+            this->count_empty();
+
             return false;
         }
         else {
             if (pitem != nullptr) {
-                *pitem = *reinterpret_cast<T*>(buffer + head);
+                *pitem = std::move(*reinterpret_cast<T*>(buffer + head));
             }
 
             /*
              * Call destructor for 'T'.  If 'T' is a POD or built-in type, this will be
              * a NOP.
              */
-            reinterpret_cast<T*>(buffer + tail)->~T();
+            reinterpret_cast<T*>(buffer + head)->~T();
 
-            head = (head + 1) % fifo_cap;
+            head = this->wrap(head + 1);
             fifo_size--;
+            this->count_remove(1);
 
             return true;
         }
     }
 
-    /**
-     * Returns a pointer to the element at the front of FIFO without removing
-     * it from the buffer.
+    /*
+     * Adds up to 'n' elements from 'items' to the back of the FIFO.  The copy is
+     * done in at most two contiguous segments (before and after the wrap point);
+     * trivially copyable types are copied with one memcpy per segment.
      *
-     * return: Returns pointer to element or null if FIFO is empty.
+     * @return Returns the number of elements added, which is less than 'n' if
+     *         the FIFO became full.
      */
-    bool peek(T *pitem) const {
-        if (fifo_size > 0) {
-            *pitem = *reinterpret_cast<T*>(buffer + tail);
-            return true;
-        }
-        else {
-            return false;
+    size_t add_n(const T *items, size_t n) {
+        size_t  cnt = std::min(n, this->cap() - fifo_size);
+        size_t  first = std::min(cnt, contig(tail));
+
+        copy_in(buffer + tail, items, first, trivial_t());
+        copy_in(buffer, items + first, cnt - first, trivial_t());
+
+        tail = this->wrap(tail + cnt);
+        fifo_size += cnt;
+        this->count_add(cnt, fifo_size);
+
+        if (cnt < n) {
+            this->count_full();
         }
-    }
-};
 
-/*
- * Implements a thread-safe FIFO buffer.
- *
- * Provides a thread-safe wrapper for the FIFOBuff class.  The interface for
- * FIFOBuff_TS is almost identical to FIFOBuff, but adds two methods: 'add_wait()' and
- * 'remove_wait()'.  Both block until the necessary resource is available.  The 'size()'
- * method is removed since the result is only approximate for multi-threaded environments.
- *
- * NOTE: for the sake of simplicity, no error checking is done on OS semaphore/mutex
- * calls.
- */
-template <typename T>
-class FIFOBuff_TS {
-    FIFOBuff<T>         fifo;
-    pthread_mutex_t     mutex;
-    sem_t               *add_sem;
-    sem_t               *rem_sem;
+        return cnt;
+    }
 
     /*
-     * Initialize Posix/pthread semaphores and mutex.
+     * Removes up to 'n' elements from the front of the FIFO.  The counterpart of
+     * 'add_n()'.
+     *
+     * @param pitems If not null, removed elements are moved to 'pitems', which
+     *        must have room for 'n' elements.
+     * @return Returns the number of elements removed, which is less than 'n' if
+     *         the FIFO became empty.
      */
-    void init() {
-        add_sem = sem_open("TSQueue_AddSem", O_CREAT, 0600, fifo.capacity());
-        rem_sem = sem_open("TSQueue_RemSem", O_CREAT, 0600, 0);
-        sem_unlink("TSQueue_AddSem");
-        sem_unlink("TSQueue_RemSem");
-        pthread_mutex_init(&mutex, nullptr);
-    }
+    size_t remove_n(T *pitems, size_t n) {
+        size_t  cnt = std::min(n, fifo_size);
+        size_t  first = std::min(cnt, contig(head));
 
-public:
+        move_out(pitems, buffer + head, first, trivial_t());
+        move_out(pitems != nullptr ? pitems + first : nullptr, buffer, cnt - first, trivial_t());
 
-    FIFOBuff_TS() = delete;
+        head = this->wrap(head + cnt);
+        fifo_size -= cnt;
 
-    FIFOBuff_TS(size_t max_cap) : fifo(max_cap) {
-        init();
-    }
+        if (cnt == 0 && n > 0) {
+            this->count_empty();
+        }
+        else {
+            this->count_remove(cnt);
+        }
 
-    FIFOBuff_TS(void *buf, size_t max_cap) : fifo(buf, max_cap) {
-        init();
+        return cnt;
     }
 
+    /*
+     * Reserves up to 'n' unused slots at the back of the FIFO so the caller can
+     * write elements directly into the FIFO buffer.  Nothing is added until
+     * 'commit()' is called.  The slots are raw memory; for a non-trivial 'T' the
+     * caller must construct elements in them with placement new.
+     *
+     * @return Returns the reserved slots, which may be fewer than 'n' if the FIFO
+     *         doesn't have room.
+     */
+    span_pair_t prepare(size_t n) {
+        span_pair_t sp;
+        size_t      cnt = std::min(n, this->cap() - fifo_size);
 
-    ~FIFOBuff_TS() {
-        /*
-         * Cleanup semaphores and mutex.
-         */
-        sem_close(add_sem);
-        sem_close(rem_sem);
-        pthread_mutex_destroy(&mutex);
+        sp.first.ptr = reinterpret_cast<T*>(buffer + tail);
+        sp.first.len = std::min(cnt, contig(tail));
+        sp.second.ptr = reinterpret_cast<T*>(buffer);
+        sp.second.len = cnt - sp.first.len;
+
+        return sp;
     }
 
     /*
-     * Same as FIFOBuff except thread-safe.
+     * Adds the first 'k' slots returned by 'prepare()' to the back of the FIFO.
+     * The slots must contain constructed elements.
+     */
+    void commit(size_t k) {
+        assert(k <= this->cap() - fifo_size);
+
+        tail = this->wrap(tail + k);
+        fifo_size += k;
+        this->count_add(k, fifo_size);
+    }
+
+    /*
+     * Returns the elements currently in the FIFO, front first, so they can be
+     * read in place without removing them.
+     */
+    span_pair_t data() const {
+        span_pair_t sp;
+
+        sp.first.ptr = reinterpret_cast<T*>(buffer + head);
+        sp.first.len = std::min(fifo_size, contig(head));
+        sp.second.ptr = reinterpret_cast<T*>(buffer);
+        sp.second.len = fifo_size - sp.first.len;
+
+        return sp;
+    }
+
+    /*
+     * Removes (and destroys) the first 'k' elements returned by 'data()'.
+     */
+    void consume(size_t k) {
+        assert(k <= fifo_size);
+
+        remove_n(nullptr, k);
+    }
+
+    /**
+     * Returns a pointer to the element at the front of FIFO without removing
+     * it from the buffer.
+     *
+     * return: Returns pointer to element or null if FIFO is empty.
+     */
+    bool peek(T *pitem) const {
+        if (fifo_size > 0) {
+            *pitem = *reinterpret_cast<T*>(buffer + head);
+            return true;
+        }
+        else {
+            return false;
+        }
+    }
+};
+
+/*
+ * Deadlines for timed waits are on the monotonic clock.  'FIFODeadline::max()'
+ * means wait forever.
+ */
+typedef std::chrono::steady_clock           FIFOClock;
+typedef std::chrono::steady_clock::time_point FIFODeadline;
+
+/*
+ * Result of a timed wait.
+ */
+enum FIFOStatus {
+    FIFO_OK,            // Operation completed.
+    FIFO_TIMEOUT,       // Deadline passed first; nothing was added/removed.
+    FIFO_CLOSED,        // FIFO was closed (and, for removal, is empty).
+    FIFO_DROPPED        // FIFO was full and its overflow policy dropped the element.
+};
+
+/*
+ * Parks threads waiting for a 32-bit counter to change and wakes them.  On Linux
+ * this is a futex on the counter itself and the object is empty; elsewhere a
+ * mutex/condition variable pair stands in.
+ */
+class FIFOParker {
+#ifndef __linux__
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+#endif
+
+    static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t), "futex word must be 32 bits");
+
+public:
+
+    FIFOParker() {
+#ifndef __linux__
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+#endif
+    }
+
+    ~FIFOParker() {
+#ifndef __linux__
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+#endif
+    }
+
+    /*
+     * Blocks while '*addr' equals 'expected', or until 'deadline' passes.  May
+     * return spuriously.
+     */
+    void wait(std::atomic<int32_t> *addr, int32_t expected, FIFODeadline deadline = FIFODeadline::max()) {
+        struct timespec ts;
+        struct timespec *pts = nullptr;
+
+        if (deadline != FIFODeadline::max()) {
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - FIFOClock::now()).count();
+
+            if (ns <= 0) {
+                return;
+            }
+
+#ifndef __linux__
+            // Condition variables time out on the realtime clock, at an absolute time.
+            struct timespec now;
+
+            clock_gettime(CLOCK_REALTIME, &now);
+            ns += now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pts = &ts;
+        }
+
+#ifdef __linux__
+        // FUTEX_WAIT takes a timeout relative to now, measured on the monotonic clock.
+        syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+#else
+        pthread_mutex_lock(&mutex);
+
+        if (addr->load() == expected) {
+            if (pts != nullptr) {
+                pthread_cond_timedwait(&cond, &mutex, pts);
+            }
+            else {
+                pthread_cond_wait(&cond, &mutex);
+            }
+        }
+
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+
+    /*
+     * Wakes up to 'n' threads blocked in 'wait()' on 'addr'.
+     */
+    void wake(std::atomic<int32_t> *addr, int n) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+        (void)addr;
+        (void)n;
+
+        // Taking the mutex orders the wake after any waiter's check of '*addr'.
+        pthread_mutex_lock(&mutex);
+        pthread_mutex_unlock(&mutex);
+        pthread_cond_broadcast(&cond);
+#endif
+    }
+};
+
+/*
+ * Tells the CPU this is a spin-wait loop (x86 'pause', ARM 'yield').
+ */
+inline void fifo_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * How a thread waits in a blocking call when the resource isn't available: spin
+ * (with a pause instruction) up to 'spin' times, then call 'sched_yield()' up to
+ * 'yields' times, and only then park in the kernel.  Spinning trades CPU time for
+ * a lower handoff latency when waits are short.
+ *
+ * With 'adaptive' set, the number of spins actually used moves toward twice the
+ * spins recent waits needed (never more than 'spin'); waits that end up parking
+ * shrink it, so a queue that mostly idles stops burning CPU.
+ *
+ * The default policy parks immediately.
+ */
+struct FIFOWaitPolicy {
+    uint32_t    spin;
+    uint32_t    yields;
+    bool        adaptive;
+
+    FIFOWaitPolicy(uint32_t spin = 0, uint32_t yields = 0, bool adaptive = false) :
+            spin(spin), yields(yields), adaptive(adaptive) {
+    }
+};
+
+/*
+ * Lower bound on an adaptive spin budget so it can grow again after shrinking.
+ */
+#define FIFOBUFF_MIN_SPIN 16
+
+/*
+ * Event count: parks threads of a lock-free FIFO until the condition they wait
+ * for (room, an element) may have become true, without a lock or a semaphore
+ * count on the fast path.
+ *
+ * A waiter loops: try the operation, and if it fails call 'await()' with a
+ * check of its condition.  'await()' spins and yields as the FIFOWaitPolicy says,
+ * then registers as a waiter, rechecks and parks.  The side that makes the
+ * condition true calls 'notify()', which is a fence and a load unless a thread
+ * is parked.
+ */
+class FIFOEventCount {
+    std::atomic<int32_t>    epoch;
+    std::atomic<int32_t>    waiters;
+    FIFOParker              parker;
+    FIFOWaitPolicy          policy;
+
+public:
+
+    FIFOEventCount() : epoch(0), waiters(0) {
+    }
+
+    /*
+     * Call before the FIFO is shared between threads.  'adaptive' is ignored.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &p) {
+        policy = p;
+    }
+
+    /*
+     * One step of waiting for 'ready()'.  'step' counts the steps taken so far
+     * (start at 0).  May return before 'ready()' is true; the caller retries.
+     */
+    template <typename F>
+    void await(unsigned &step, F &&ready, FIFODeadline deadline = FIFODeadline::max()) {
+        int32_t key;
+
+        if (step < policy.spin) {
+            fifo_cpu_relax();
+            step++;
+
+            return;
+        }
+
+        if (step < policy.spin + policy.yields) {
+            sched_yield();
+            step++;
+
+            return;
+        }
+
+        // Registering before the recheck pairs with the fence in 'notify()'.
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        key = epoch.load(std::memory_order_relaxed);
+
+        if (!ready()) {
+            parker.wait(&epoch, key, deadline);
+        }
+
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /*
+     * Wakes up to 'n' parked threads, if any, after the condition changed.
+     */
+    void notify(int n = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+            parker.wake(&epoch, n);
+        }
+    }
+
+    void notify_all() {
+        notify(INT32_MAX);
+    }
+};
+
+/*
+ * Counting semaphore that lives in the object (no named/kernel object to create).
+ *
+ * Taking and posting units are single atomic operations.  The kernel is only
+ * entered when a thread has to sleep because too few units are available, or
+ * when a post sees a thread is sleeping; uncontended use never makes a system
+ * call.
+ *
+ * Sleeping threads are kept in a list, each with the number of units it needs
+ * and its own word to park on.  A post only wakes sleepers whose need is covered,
+ * so a thread waiting for a batch isn't woken for every unit.
+ */
+class FIFOSem {
+    struct sleeper_t {
+        size_t                  need;
+        std::atomic<int32_t>    woken;
+        sleeper_t               *next;
+    };
+
+    std::atomic<int32_t>    count;
+    std::atomic<int32_t>    waiters;
+    std::atomic<int32_t>    min_need;
+    std::atomic<bool>       closed;
+    pthread_mutex_t         wait_lock;
+    sleeper_t               *sleepers;
+    FIFOParker              parker;
+    FIFOWaitPolicy          policy;
+    std::atomic<uint32_t>   spin_budget;
+
+    /*
+     * Recomputes the smallest need of any sleeper.  Caller must hold 'wait_lock'.
+     */
+    void update_min_need() {
+        int32_t need = INT32_MAX;
+
+        for (sleeper_t *sl = sleepers; sl != nullptr; sl = sl->next) {
+            need = std::min(need, (int32_t)sl->need);
+        }
+
+        min_need.store(need, std::memory_order_relaxed);
+    }
+
+    /*
+     * Removes 'sl' from the sleeper list if it's still there.  Caller must hold
+     * 'wait_lock'.
+     */
+    void unlink(sleeper_t *sl) {
+        for (sleeper_t **pp = &sleepers; *pp != nullptr; pp = &(*pp)->next) {
+            if (*pp == sl) {
+                *pp = sl->next;
+                break;
+            }
+        }
+
+        update_min_need();
+    }
+
+    /*
+     * Moves the adaptive spin budget toward twice 'spins', the spins it took for
+     * units to become available (0 if the thread had to park).
+     */
+    void adapt(uint32_t spins) {
+        int64_t budget = spin_budget.load(std::memory_order_relaxed);
+
+        if (policy.adaptive) {
+            budget += ((int64_t)spins * 2 - budget) / 8;
+            budget = std::max<int64_t>(budget, FIFOBUFF_MIN_SPIN);
+            budget = std::min<int64_t>(budget, policy.spin);
+
+            spin_budget.store((uint32_t)budget, std::memory_order_relaxed);
+        }
+    }
+
+    /*
+     * Spins, then yields, per the wait policy, watching for 'min' units to take.
+     *
+     * return: Returns the number of units taken (0 if none).
+     */
+    size_t spin_wait(size_t min, size_t max) {
+        uint32_t    limit = policy.adaptive ? spin_budget.load(std::memory_order_relaxed) : policy.spin;
+        size_t      n;
+
+        for (uint32_t i = 0; i < limit; i++) {
+            fifo_cpu_relax();
+
+            if (count.load(std::memory_order_relaxed) >= (int32_t)min && (n = try_wait_n(min, max)) > 0) {
+                adapt(i);
+                return n;
+            }
+        }
+
+        for (uint32_t i = 0; i < policy.yields; i++) {
+            sched_yield();
+
+            if ((n = try_wait_n(min, max)) > 0) {
+                adapt(limit);
+                return n;
+            }
+        }
+
+        adapt(0);
+
+        return 0;
+    }
+
+public:
+
+    FIFOSem(size_t init) : count((int32_t)init), waiters(0), min_need(INT32_MAX), closed(false), sleepers(nullptr), spin_budget(0) {
+        assert(init <= INT32_MAX);
+        pthread_mutex_init(&wait_lock, nullptr);
+    }
+
+    ~FIFOSem() {
+        pthread_mutex_destroy(&wait_lock);
+    }
+
+    /*
+     * Sets how 'wait()' waits for a unit.  Not thread-safe with 'wait()'.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &wait_policy) {
+        policy = wait_policy;
+        spin_budget.store(policy.adaptive ? policy.spin : 0, std::memory_order_relaxed);
+    }
+
+    /*
+     * Takes a unit if one is available.
+     *
+     * return: Returns true if a unit was taken, false if count was zero.
+     */
+    bool try_wait() {
+        return try_wait_n(1, 1) != 0;
+    }
+
+    /*
+     * If at least 'min' units are available, takes as many as are available up
+     * to 'max'.
+     *
+     * return: Returns the number of units taken.
+     */
+    size_t try_wait_n(size_t min, size_t max) {
+        int32_t c = count.load(std::memory_order_relaxed);
+
+        while (c > 0 && (size_t)c >= min) {
+            int32_t take = (int32_t)std::min<size_t>(c, max);
+
+            if (count.compare_exchange_weak(c, c - take, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return take;
+            }
+        }
+
+        return 0;
+    }
+
+    /*
+     * Takes a unit, blocking until one is available.
+     */
+    void wait() {
+        wait_n(1, 1);
+    }
+
+    /*
+     * Takes a unit, blocking until one is available or 'deadline' passes.
+     *
+     * return: Returns true if a unit was taken, false on timeout.
+     */
+    bool wait_until(FIFODeadline deadline) {
+        return wait_n(1, 1, deadline) != 0;
+    }
+
+    /*
+     * Blocks until at least 'min' units are available, then takes as many as are
+     * available up to 'max'.  If 'deadline' passes first, or the semaphore is
+     * closed, takes whatever is available (possibly none) up to 'max'.
+     *
+     * return: Returns the number of units taken.
+     */
+    size_t wait_n(size_t min, size_t max, FIFODeadline deadline = FIFODeadline::max()) {
+        size_t  n;
+
+        if ((n = try_wait_n(min, max)) > 0 || min == 0) {
+            return n;
+        }
+
+        if (closed.load(std::memory_order_acquire)) {
+            return try_wait_n(1, max);
+        }
+
+        if ((n = spin_wait(min, max)) > 0) {
+            return n;
+        }
+
+        for (;;) {
+            sleeper_t   sl;
+            bool        sleep;
+
+            sl.need = min;
+            sl.woken.store(0, std::memory_order_relaxed);
+
+            /*
+             * Register as a sleeper before the final check of the count.  A post
+             * either sees the sleeper (and wakes it when its need is covered) or
+             * its increment is seen here.
+             */
+            pthread_mutex_lock(&wait_lock);
+
+            sl.next = sleepers;
+            sleepers = &sl;
+            min_need.store(std::min(min_need.load(std::memory_order_relaxed), (int32_t)min), std::memory_order_relaxed);
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+
+            sleep = !closed.load(std::memory_order_relaxed) && count.load(std::memory_order_seq_cst) < (int32_t)min;
+
+            if (!sleep) {
+                unlink(&sl);
+            }
+
+            pthread_mutex_unlock(&wait_lock);
+
+            if (sleep) {
+                parker.wait(&sl.woken, 0, deadline);
+
+                pthread_mutex_lock(&wait_lock);
+                unlink(&sl);
+                pthread_mutex_unlock(&wait_lock);
+            }
+
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+
+            if ((n = try_wait_n(min, max)) > 0) {
+                return n;
+            }
+
+            if (closed.load(std::memory_order_acquire) ||
+                    (deadline != FIFODeadline::max() && FIFOClock::now() >= deadline)) {
+                return try_wait_n(1, max);
+            }
+        }
+    }
+
+    /*
+     * Stops waits from blocking.  Sleeping threads are woken, and they and any
+     * later waits take whatever is available (possibly none) without sleeping.
+     */
+    void close() {
+        pthread_mutex_lock(&wait_lock);
+
+        closed.store(true, std::memory_order_release);
+
+        for (sleeper_t *sl = sleepers; sl != nullptr; sl = sl->next) {
+            sl->woken.store(1, std::memory_order_relaxed);
+            parker.wake(&sl->woken, 1);
+        }
+
+        sleepers = nullptr;
+        update_min_need();
+
+        pthread_mutex_unlock(&wait_lock);
+    }
+
+    /*
+     * Returns 'n' units and wakes waiting threads whose need is covered.
+     *
+     * return: Returns the count before the units were added.
+     */
+    int32_t post(size_t n = 1) {
+        int32_t prev = count.fetch_add((int32_t)n, std::memory_order_seq_cst);
+        int32_t c = prev + (int32_t)n;
+
+        /*
+         * The sleeper list is only locked if a sleeper may now be able to go.  A
+         * sleeper publishes its need before registering in 'waiters', so it is
+         * seen here if it was counted.
+         */
+        if (waiters.load(std::memory_order_seq_cst) > 0 && c >= min_need.load(std::memory_order_relaxed)) {
+            pthread_mutex_lock(&wait_lock);
+
+            c = count.load(std::memory_order_relaxed);
+
+            for (sleeper_t **pp = &sleepers; *pp != nullptr && c > 0; ) {
+                sleeper_t   *sl = *pp;
+
+                if ((int32_t)sl->need <= c) {
+                    c -= sl->need;
+                    *pp = sl->next;
+
+                    sl->woken.store(1, std::memory_order_relaxed);
+                    parker.wake(&sl->woken, 1);
+                }
+                else {
+                    pp = &sl->next;
+                }
+            }
+
+            update_min_need();
+            pthread_mutex_unlock(&wait_lock);
+        }
+
+        return prev;
+    }
+};
+
+/*
+ * Returns a small integer unique to the calling thread (0 for the first thread
+ * that asks, 1 for the next, ...).
+ */
+inline size_t fifo_thread_index() {
+    static std::atomic<size_t>  next(0);
+    static thread_local size_t  index = next.fetch_add(1, std::memory_order_relaxed);
+
+    return index;
+}
+
+/*
+ * FIFOBuff_TS synchronization policies.  'run(f)' calls 'f()' with exclusive
+ * access to the FIFO.
+ */
+
+/*
+ * Default policy: a pthread mutex around each critical section.
+ */
+class FIFOMutex {
+    pthread_mutex_t     mutex;
+
+public:
+
+    FIFOMutex() {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+
+    ~FIFOMutex() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    template <typename F>
+    void run(F &&f) {
+        pthread_mutex_lock(&mutex);
+        f();
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+#ifndef FIFOBUFF_FC_SLOTS
+#define FIFOBUFF_FC_SLOTS 64
+#endif
+
+/*
+ * Flat-combining policy (Hendler et al.).  A thread publishes its critical
+ * section in its own slot, then either takes the lock and runs every published
+ * request in one pass (becoming the combiner), or spins until a combiner has run
+ * its request.  Under contention the FIFO and the lock stay in one core's cache
+ * while others only touch their own slot, instead of the lock's cache line moving
+ * for every operation.  Uncontended, it's a test-and-set lock plus a scan of the
+ * slots in use.  Waiters spin (then yield) rather than sleep, so it pays off when
+ * contending threads each have a core; with cores oversubscribed, a preempted
+ * combiner stalls the others and FIFOMutex does better.
+ *
+ * Requests run on whichever thread is combining, so they must not throw (i.e.
+ * 'T's constructors and assignment, with FIFOBuff_TS).  Threads whose slot
+ * (thread index modulo FIFOBUFF_FC_SLOTS) is taken fall back to taking the lock.
+ */
+class FIFOCombiner {
+    struct req_t {
+        void                (*fn)(void *f);
+        void                *f;
+        std::atomic<bool>   done;
+    };
+
+    struct alignas(FIFOBUFF_CACHE_LINE) slot_t {
+        std::atomic<req_t*> req;
+    };
+
+    slot_t                  slots[FIFOBUFF_FC_SLOTS];
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<bool>       locked;
+    std::atomic<size_t>     used;       // Slots in [0, used) may hold requests.
+
+    template <typename F>
+    static void call(void *f) {
+        (*static_cast<F*>(f))();
+    }
+
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+
+    /*
+     * Runs all published requests.  Called with the lock held.
+     */
+    void combine() {
+        size_t  n = used.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < n; i++) {
+            req_t   *r = slots[i].req.load(std::memory_order_acquire);
+
+            if (r != nullptr) {
+                r->fn(r->f);
+                slots[i].req.store(nullptr, std::memory_order_relaxed);
+                r->done.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    static void pause(unsigned &spins) {
+        if (spins < 64) {
+            fifo_cpu_relax();
+            spins++;
+        }
+        else {
+            sched_yield();
+        }
+    }
+
+public:
+
+    FIFOCombiner() : locked(false), used(0) {
+        for (size_t i = 0; i < FIFOBUFF_FC_SLOTS; i++) {
+            slots[i].req.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename F>
+    void run(F &&f) {
+        typedef typename std::remove_reference<F>::type func_t;
+
+        size_t      idx = fifo_thread_index() % FIFOBUFF_FC_SLOTS;
+        size_t      n = used.load(std::memory_order_relaxed);
+        req_t       r;
+        req_t       *expect = nullptr;
+        unsigned    spins = 0;
+
+        // Lock free: no need to publish.
+        if (try_lock()) {
+            f();
+            combine();
+            unlock();
+
+            return;
+        }
+
+        r.fn = &call<func_t>;
+        r.f = (void*)&f;
+        r.done.store(false, std::memory_order_relaxed);
+
+        while (n <= idx && !used.compare_exchange_weak(n, idx + 1, std::memory_order_release)) {
+        }
+
+        if (!slots[idx].req.compare_exchange_strong(expect, &r, std::memory_order_release, std::memory_order_relaxed)) {
+            // Slot shared with another thread and in use; just take the lock.
+            while (!try_lock()) {
+                pause(spins);
+            }
+
+            f();
+            combine();
+            unlock();
+
+            return;
+        }
+
+        while (!r.done.load(std::memory_order_acquire)) {
+            if (try_lock()) {
+                // Our request is published, so this pass runs it.
+                combine();
+                unlock();
+            }
+            else {
+                pause(spins);
+            }
+        }
+    }
+};
+
+/*
+ * FIFO Overflow Policies
+ *
+ * Passed as the 'Overflow' template parameter of FIFOBuff_TS; they decide what
+ * happens to an element added while the FIFO is full.
+ *
+ * FIFOBlock (the default) keeps the usual behavior: 'add()' fails and
+ * 'add_wait()' waits for room.  With any other policy adds never wait, and an
+ * element that doesn't fit is handled by the policy instead:
+ *
+ *   FIFORejectNewest   drops it.
+ *   FIFODropOldest     evicts the oldest element to make room for it.
+ *   FIFOSampleDrop     drops it and, once the FIFO is 'MarkPct' percent full,
+ *                      lets in only one add in 'Keep', so load is shed gradually
+ *                      before the FIFO fills.
+ *   FIFOSpill          adds it to a secondary FIFO, or drops it if that's full
+ *                      too.
+ *
+ * 'wait' and 'evict' select the behavior.  'admit()' is called under the lock for
+ * each add (a bulk add counts as one) with the number of elements already in the
+ * FIFO; returning false drops it.  'spill()' is offered each element that didn't
+ * fit; returning true means it was taken.
+ */
+struct FIFOBlock {
+    static const bool wait = true;
+    static const bool evict = false;
+
+    bool admit(size_t, size_t) {
+        return true;
+    }
+
+    template <typename... Args>
+    bool spill(Args&&...) {
+        return false;
+    }
+};
+
+struct FIFORejectNewest {
+    static const bool wait = false;
+    static const bool evict = false;
+
+    bool admit(size_t, size_t) {
+        return true;
+    }
+
+    template <typename... Args>
+    bool spill(Args&&...) {
+        return false;
+    }
+};
+
+struct FIFODropOldest {
+    static const bool wait = false;
+    static const bool evict = true;
+
+    bool admit(size_t, size_t) {
+        return true;
+    }
+
+    template <typename... Args>
+    bool spill(Args&&...) {
+        return false;
+    }
+};
+
+template <unsigned Keep = 8, unsigned MarkPct = 75>
+class FIFOSampleDrop {
+    static_assert(Keep > 0 && MarkPct <= 100, "FIFOSampleDrop needs Keep > 0 and MarkPct <= 100");
+
+    unsigned    seq;        // Adds seen above the mark; guarded by the FIFO's lock.
+
+public:
+    static const bool wait = false;
+    static const bool evict = false;
+
+    FIFOSampleDrop() : seq(0) {
+    }
+
+    bool admit(size_t size, size_t cap) {
+        if (size * 100 < cap * MarkPct) {
+            seq = 0;
+
+            return true;
+        }
+
+        return seq++ % Keep == 0;
+    }
+
+    template <typename... Args>
+    bool spill(Args&&...) {
+        return false;
+    }
+};
+
+/*
+ * 'Q' must be thread-safe, with an 'emplace()' that returns true if the element
+ * was added (e.g. another FIFOBuff_TS, drained by a slower consumer).  Until
+ * 'set_target()' is called, elements that don't fit are dropped.
+ */
+template <typename Q>
+class FIFOSpill {
+    Q   *target;
+
+public:
+    static const bool wait = false;
+    static const bool evict = false;
+
+    FIFOSpill() : target(nullptr) {
+    }
+
+    /*
+     * Sets the FIFO that takes the elements that don't fit.  Call before the FIFO
+     * is shared between threads.
+     */
+    void set_target(Q *q) {
+        target = q;
+    }
+
+    bool admit(size_t, size_t) {
+        return true;
+    }
+
+    template <typename... Args>
+    bool spill(Args&&... args) {
+        return target != nullptr && target->emplace(std::forward<Args>(args)...);
+    }
+};
+
+/*
+ * Implements a thread-safe FIFO buffer.
+ *
+ * Provides a thread-safe wrapper for the FIFOBuff class.  The interface for
+ * FIFOBuff_TS is almost identical to FIFOBuff, but adds two methods: 'add_wait()' and
+ * 'remove_wait()'.  Both block until the necessary resource is available.  The 'size()'
+ * method is removed since the result is only approximate for multi-threaded environments.
+ *
+ * The free slots and available elements are counted by two FIFOSem semaphores
+ * that live in the object, so uncontended operations make no system calls.
+ *
+ * 'close()' shuts the FIFO down: adds fail from then on, while removes drain the
+ * remaining elements and then report FIFO_CLOSED (end-of-stream).
+ *
+ * For event loops, 'enable_event_fd()' provides an eventfd that becomes readable
+ * when elements become available (see there).
+ *
+ * The 'Sync' policy guards the FIFOBuff: FIFOMutex (default) or FIFOCombiner
+ * (flat combining, for many threads contending on one FIFO).
+ *
+ * With the FIFOStats policy, 'stats()' also reports how often and how long
+ * 'add_wait()'/'remove_wait()' (and the bulk versions) blocked.
+ *
+ * The 'Overflow' policy decides what a full FIFO does with new elements: wait
+ * for room (FIFOBlock, the default), or shed them without waiting (see the FIFO
+ * Overflow Policies).  'dropped()' counts the elements shed.
+ *
+ * NOTE: for the sake of simplicity, no error checking is done on OS mutex calls.
+ */
+template <typename T, size_t N = 0, typename Sync = FIFOMutex, typename Stats = FIFONoStats,
+          typename Overflow = FIFOBlock>
+class FIFOBuff_TS : private Stats, private Overflow {
+    FIFOBuff<T, N>      fifo;
+    Sync                lock;
+    FIFOSem             add_sem;
+    FIFOSem             rem_sem;
+    std::atomic<bool>   is_closed;
+    std::atomic<size_t> drop_cnt;
+    std::atomic<size_t> spill_cnt;
+    int                 event_fd;
+    size_t              event_mark;
+
+    void init() {
+        is_closed.store(false, std::memory_order_relaxed);
+        drop_cnt.store(0, std::memory_order_relaxed);
+        spill_cnt.store(0, std::memory_order_relaxed);
+        event_fd = -1;
+        event_mark = 0;
+    }
+
+    /*
+     * Makes the eventfd readable.
+     */
+    void signal_event() {
+        uint64_t    one = 1;
+        ssize_t     res;
+
+        // Only fails if the counter is saturated, which is already readable.
+        res = write(event_fd, &one, sizeof(one));
+        (void)res;
+    }
+
+    /*
+     * Posts 'n' newly added elements to consumers, signaling the eventfd (if
+     * enabled) when the number of available elements goes from zero to non-zero
+     * or crosses the watermark.  A run of adds while elements are available
+     * causes no eventfd writes.
+     */
+    void post_added(size_t n) {
+        int32_t prev = rem_sem.post(n);
+
+        if (event_fd >= 0 &&
+                (prev <= 0 || (event_mark > 0 && (size_t)prev < event_mark && (size_t)prev + n >= event_mark))) {
+            signal_event();
+        }
+    }
+
+    /*
+     * Same as 'FIFOSem::wait_n()' on 'sem'.  With stats enabled, a call that has
+     * to wait is timed and counted as a blocked add or remove.
+     */
+    size_t acquire(FIFOSem &sem, size_t min, size_t max, FIFODeadline deadline, bool adding) {
+        FIFOClock::time_point   start;
+        size_t                  n;
+        uint64_t                ns;
+
+        if (!Stats::enabled) {
+            return sem.wait_n(min, max, deadline);
+        }
+
+        if ((n = sem.try_wait_n(min, max)) > 0 || min == 0) {
+            return n;
+        }
+
+        start = FIFOClock::now();
+        n = sem.wait_n(min, max, deadline);
+        ns = std::chrono::duration_cast<std::chrono::nanoseconds>(FIFOClock::now() - start).count();
+
+        if (adding) {
+            this->count_add_blocked(ns);
+        }
+        else {
+            this->count_remove_blocked(ns);
+        }
+
+        return n;
+    }
+
+    /*
+     * Adds an element once room has been reserved in 'add_sem'.  If the FIFO has
+     * been closed, or the overflow policy doesn't admit the element, the
+     * reservation is handed back instead.
+     *
+     * return: Returns FIFO_OK, FIFO_CLOSED or FIFO_DROPPED.
+     */
+    template <typename... Args>
+    FIFOStatus put(Args&&... args) {
+        FIFOStatus  res = FIFO_OK;
+
+        lock.run([&]() {
+            if (is_closed.load(std::memory_order_relaxed)) {
+                res = FIFO_CLOSED;
+            }
+            else if (!this->admit(fifo.size(), fifo.capacity())) {
+                res = FIFO_DROPPED;
+            }
+            else {
+                fifo.emplace(std::forward<Args>(args)...);
+                this->count_add(1, fifo.size());
+            }
+        });
+
+        if (res != FIFO_OK) {
+            add_sem.post();
+
+            if (res == FIFO_DROPPED) {
+                drop_cnt.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return res;
+        }
+
+        post_added(1);
+
+        return FIFO_OK;
+    }
+
+    /*
+     * Same as 'put()' for 'cnt' elements.
      */
-    bool add(const T &item) {
-        if (sem_trywait(add_sem) == 0) {
-            pthread_mutex_lock(&mutex);
-            fifo.add(item);
-            pthread_mutex_unlock(&mutex);
+    FIFOStatus put_n(const T *items, size_t cnt) {
+        FIFOStatus  res = FIFO_OK;
+
+        lock.run([&]() {
+            if (is_closed.load(std::memory_order_relaxed)) {
+                res = FIFO_CLOSED;
+            }
+            else if (!this->admit(fifo.size(), fifo.capacity())) {
+                res = FIFO_DROPPED;
+            }
+            else {
+                fifo.add_n(items, cnt);
+                this->count_add(cnt, fifo.size());
+            }
+        });
 
-            sem_post(rem_sem);
+        if (res != FIFO_OK) {
+            add_sem.post(cnt);
 
-            return true;
+            if (res == FIFO_DROPPED) {
+                drop_cnt.fetch_add(cnt, std::memory_order_relaxed);
+            }
+
+            return res;
         }
-        else {
-            return false;
+
+        post_added(cnt);
+
+        return FIFO_OK;
+    }
+
+    /*
+     * Hands an element that didn't fit to the overflow policy (never FIFOBlock):
+     * it evicts the oldest element to make room, spills it, or drops it.
+     *
+     * With no room left in 'add_sem', every slot holds an element or is reserved
+     * by an add (or a remove) that hasn't finished, so an eviction replaces the
+     * oldest element under the lock even if the FIFO isn't full yet.  Only a FIFO
+     * with no element at all to evict has to wait, briefly, for one of those to
+     * finish.
+     *
+     * return: Returns FIFO_OK if the element was added or spilled, FIFO_DROPPED
+     *         if not, or FIFO_CLOSED if the FIFO is closed.
+     */
+    template <typename... Args>
+    FIFOStatus shed(Args&&... args) {
+        if (is_closed.load(std::memory_order_acquire)) {
+            return FIFO_CLOSED;
+        }
+
+        if (Overflow::evict) {
+            for (;;) {
+                FIFOStatus  res = FIFO_TIMEOUT;
+
+                if (add_sem.try_wait()) {
+                    return put(std::forward<Args>(args)...);
+                }
+
+                lock.run([&]() {
+                    if (is_closed.load(std::memory_order_relaxed)) {
+                        res = FIFO_CLOSED;
+                    }
+                    else if (fifo.size() > 0) {
+                        // Same number of elements, so the semaphores stay as they are.
+                        fifo.remove(nullptr);
+                        fifo.emplace(std::forward<Args>(args)...);
+                        this->count_add(1, fifo.size());
+                        this->count_evict();
+                        res = FIFO_OK;
+                    }
+                });
+
+                if (res == FIFO_OK) {
+                    drop_cnt.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                if (res != FIFO_TIMEOUT) {
+                    return res;
+                }
+
+                /*
+                 * Every slot is reserved.  A remove hands one back through
+                 * 'add_sem'; an add that finishes leaves an element to evict,
+                 * which the timeout lets us notice.
+                 */
+                if (add_sem.wait_until(FIFOClock::now() + std::chrono::milliseconds(1))) {
+                    return put(std::forward<Args>(args)...);
+                }
+            }
+        }
+
+        if (this->spill(std::forward<Args>(args)...)) {
+            spill_cnt.fetch_add(1, std::memory_order_relaxed);
+
+            return FIFO_OK;
+        }
+
+        drop_cnt.fetch_add(1, std::memory_order_relaxed);
+
+        return FIFO_DROPPED;
+    }
+
+    /*
+     * Called when a consumer found nothing to take from a closed FIFO.  An add
+     * that got in before 'close()' may have inserted its element but not posted
+     * it yet, so the stream has only ended once the FIFO is empty.
+     *
+     * return: Returns true if no elements remain.
+     */
+    bool drained() {
+        bool    empty;
+
+        lock.run([&]() {
+            empty = fifo.size() == 0;
+        });
+
+        if (!empty) {
+            sched_yield();
+        }
+
+        return empty;
+    }
+
+    /*
+     * Removes an element with a unit of 'rem_sem' already taken, offering the head
+     * to 'hook' first (see the hooked 'remove()').  Each element dropped instead
+     * takes another unit, if one is free.
+     *
+     * return: Returns false if every element it got to was dropped.
+     */
+    template <typename Hook>
+    bool take(T *pitem, Hook &hook) {
+        for (;;) {
+            bool    kept;
+
+            lock.run([&]() {
+                kept = !hook.drop_head(*fifo.data().first.ptr, fifo.size() - 1);
+
+                if (kept) {
+                    fifo.remove(pitem);
+                    this->count_remove(1);
+                }
+                else {
+                    fifo.remove(nullptr);
+                    this->count_evict();
+                }
+
+                if (fifo.size() == 0) {
+                    hook.idle();
+                }
+            });
+
+            add_sem.post();
+
+            if (kept) {
+                return true;
+            }
+
+            if (!rem_sem.try_wait()) {
+                return false;
+            }
+        }
+    }
+
+    /*
+     * Called when a hooked remove found nothing to take.
+     */
+    template <typename Hook>
+    void found_empty(Hook &hook) {
+        this->count_empty();
+
+        lock.run([&]() {
+            if (fifo.size() == 0) {
+                hook.idle();
+            }
+        });
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_TS() : add_sem(N), rem_sem(0) {
+        init();
+    }
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    explicit FIFOBuff_TS(void *buf) : fifo(buf), add_sem(N), rem_sem(0) {
+        init();
+    }
+
+    FIFOBuff_TS(size_t max_cap) : fifo(max_cap), add_sem(fifo.capacity()), rem_sem(0) {
+        init();
+    }
+
+    FIFOBuff_TS(void *buf, size_t max_cap) : fifo(buf, max_cap), add_sem(fifo.capacity()), rem_sem(0) {
+        init();
+    }
+
+    FIFOBuff_TS(size_t max_cap, FIFOStorage storage) : fifo(max_cap, storage), add_sem(fifo.capacity()), rem_sem(0) {
+        init();
+    }
+
+
+    ~FIFOBuff_TS() {
+        /*
+         * Cleanup eventfd.
+         */
+        if (event_fd >= 0) {
+            ::close(event_fd);
+        }
+    }
+
+    /*
+     * Enables a (non-blocking) eventfd for multiplexing the FIFO in epoll/poll
+     * loops.  The eventfd becomes readable when the FIFO goes from having no
+     * elements available to having some and, if 'watermark' is non-zero, when
+     * the number available rises to 'watermark'.  It is also made readable by
+     * 'close()'.  Adds made while elements are already available don't write to
+     * the eventfd, so it isn't signaled once per element.
+     *
+     * The consumer should read the eventfd (8 bytes) to reset it, then call
+     * 'remove()' (or 'remove_wait_bulk()' with a 'min' of 0) until the FIFO is
+     * empty; otherwise it may not be signaled again.
+     *
+     * Call before the FIFO is shared between threads.  Linux only.
+     *
+     * return: Returns the eventfd, or -1 if it couldn't be created.
+     */
+    int enable_event_fd(size_t watermark = 0) {
+#ifdef __linux__
+        if (event_fd < 0) {
+            event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+#endif
+        event_mark = watermark;
+
+        return event_fd;
+    }
+
+    /*
+     * Sets how 'add_wait()'/'remove_wait()' wait when the FIFO is full/empty (see
+     * FIFOWaitPolicy).  Call before the FIFO is shared between threads.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        add_sem.set_wait_policy(policy);
+        rem_sem.set_wait_policy(policy);
+    }
+
+    /*
+     * Same as FIFOBuff except thread-safe.  With a shedding overflow policy, a
+     * full FIFO hands the element to the policy.
+     *
+     * return: Returns true if the element was added (or spilled); false if not,
+     *         in which case a shedding policy has dropped it.
+     */
+    bool add(const T &item) {
+        return emplace(item);
+    }
+
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        if (!add_sem.try_wait()) {
+            this->count_full();
+
+            return !Overflow::wait && shed(std::forward<Args>(args)...) == FIFO_OK;
         }
+
+        return put(std::forward<Args>(args)...) == FIFO_OK;
     }
 
     /*
      * Adds an element to FIFO.  If FIFO is full, the call blocks until room
-     * becomes available to add the item.
+     * becomes available to add the item.  With a shedding overflow policy it
+     * never blocks: the policy handles the element instead.
+     *
+     * return: Returns FIFO_OK, FIFO_CLOSED if the FIFO is (or gets) closed, or
+     *         FIFO_DROPPED if the overflow policy dropped the element.
      */
-    void add_wait(const T &item) {
-        sem_wait(add_sem);
+    FIFOStatus add_wait(const T &item) {
+        return emplace_wait(item);
+    }
 
-        pthread_mutex_lock(&mutex);
-        fifo.add(item);
-        pthread_mutex_unlock(&mutex);
+    FIFOStatus add_wait(T &&item) {
+        return emplace_wait(std::move(item));
+    }
 
-        sem_post(rem_sem);
+    /*
+     * Same as 'add_wait()', but the element is constructed in place from 'args'.
+     */
+    template <typename... Args>
+    FIFOStatus emplace_wait(Args&&... args) {
+        return emplace_wait_until(FIFODeadline::max(), std::forward<Args>(args)...);
     }
 
     /*
-     * Same as FIFOBuff except thread-safe.
+     * Same as 'add_wait()', but gives up once 'deadline' (on the monotonic clock)
+     * passes, or after waiting for 'timeout'.
+     *
+     * return: Returns FIFO_OK if the element was added, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is (or gets) closed.
      */
-    bool peek(T *item) {
-        bool    peek_ok = false;
+    FIFOStatus add_wait_until(const T &item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, item);
+    }
 
-        pthread_mutex_lock(&mutex);
+    FIFOStatus add_wait_until(T &&item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, std::move(item));
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(const T &item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, item);
+    }
 
-        if (fifo.size() > 0) {
-            peek_ok = true;
-            fifo.peek(item);
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(T &&item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait_until(FIFODeadline deadline, Args&&... args) {
+        if (!Overflow::wait) {
+            if (add_sem.try_wait()) {
+                return put(std::forward<Args>(args)...);
+            }
+
+            this->count_full();
+
+            return shed(std::forward<Args>(args)...);
         }
 
-        pthread_mutex_unlock(&mutex);
+        if (acquire(add_sem, 1, 1, deadline, true) == 0) {
+            return is_closed.load(std::memory_order_acquire) ? FIFO_CLOSED : FIFO_TIMEOUT;
+        }
+
+        return put(std::forward<Args>(args)...);
+    }
+
+    /*
+     * Adds up to 'n' elements from 'items' without blocking.  As much room as is
+     * available (up to 'n') is reserved in one step, the elements are copied in
+     * under one lock acquisition and consumers are woken once.
+     *
+     * With a shedding overflow policy, the elements that don't fit are handed to
+     * the policy one at a time.
+     *
+     * return: Returns the number of elements added or spilled (0 if FIFO is
+     *         closed).
+     */
+    size_t try_add_bulk(const T *items, size_t n) {
+        size_t      cnt = add_sem.try_wait_n(1, n);
+        size_t      added = 0;
+        FIFOStatus  res = FIFO_OK;
+
+        if (cnt < n) {
+            this->count_full();
+        }
+
+        if (cnt > 0 && (res = put_n(items, cnt)) == FIFO_OK) {
+            added = cnt;
+        }
+
+        if (!Overflow::wait && res != FIFO_CLOSED) {
+            for (size_t i = cnt; i < n; i++) {
+                res = add_sem.try_wait() ? put(items[i]) : shed(items[i]);
+
+                if (res == FIFO_CLOSED) {
+                    break;
+                }
+
+                if (res == FIFO_OK) {
+                    added++;
+                }
+            }
+        }
+
+        return res == FIFO_CLOSED ? 0 : added;
+    }
+
+    /*
+     * Adds 'n' elements from 'items', blocking until there is room for all of
+     * them.  Room for the whole batch is reserved in one step, the elements are
+     * copied in under one lock acquisition and consumers are woken once.  Batches
+     * larger than the capacity are added in capacity-sized pieces.
+     *
+     * With a shedding overflow policy, same as 'try_add_bulk()'.
+     *
+     * return: Returns the number of elements added, which is less than 'n' only
+     *         if the FIFO is (or gets) closed, or the overflow policy dropped
+     *         some.
+     */
+    size_t add_wait_bulk(const T *items, size_t n) {
+        size_t  added = 0;
+
+        if (!Overflow::wait) {
+            return try_add_bulk(items, n);
+        }
+
+        while (added < n) {
+            size_t  cnt = std::min(n - added, fifo.capacity());
+            size_t  got = acquire(add_sem, cnt, cnt, FIFODeadline::max(), true);
+
+            if (got != cnt) {
+                // Only possible once closed; hand back any partial reservation.
+                add_sem.post(got);
+                break;
+            }
+
+            if (put_n(items + added, cnt) != FIFO_OK) {
+                break;
+            }
+
+            added += cnt;
+        }
+
+        return added;
+    }
+
+    /*
+     * Same as FIFOBuff except thread-safe.
+     */
+    bool peek(T *item) {
+        bool    peek_ok = false;
+
+        lock.run([&]() {
+            if (fifo.size() > 0) {
+                peek_ok = true;
+                fifo.peek(item);
+            }
+        });
 
         return peek_ok;
     }
@@ -254,32 +2204,213 @@ public:
      * Same as FIFOBuff except thread-safe.
      */
     bool remove(T *pitem) {
-        if (sem_trywait(rem_sem) == 0) {
-            pthread_mutex_lock(&mutex);
-            fifo.remove(pitem);
-            pthread_mutex_unlock(&mutex);
+        if (rem_sem.try_wait()) {
+            lock.run([&]() {
+                fifo.remove(pitem);
+                this->count_remove(1);
+            });
 
-            sem_post(add_sem);
+            add_sem.post();
 
             return true;
         }
         else {
+            this->count_empty();
+
             return false;
         }
     }
 
     /*
-     * Removes an item from the FIFO and, if not null, copies data to 'pitem'.
+     * Removes a batch of elements from the FIFO.  Blocks until at least 'min'
+     * elements are available or 'deadline' passes, then removes as many as are
+     * available up to 'max' with one lock acquisition.  If the deadline passes,
+     * whatever is available (possibly nothing) is removed.  'min' is clamped to
+     * 'max' and to the capacity; a 'min' of zero never blocks.  Once the FIFO is
+     * closed, the call doesn't wait for 'min' elements.
+     *
+     * param pitems: If not null, removed elements are moved here; must have room
+     *        for 'max' elements.
+     * return: Returns the number of elements removed.  Returns 0 before the
+     *         deadline only if the FIFO is closed and empty (end-of-stream).
+     */
+    size_t remove_wait_bulk(T *pitems, size_t max, size_t min, FIFODeadline deadline = FIFODeadline::max()) {
+        size_t  cnt;
+
+        min = std::min(min, std::min(max, fifo.capacity()));
+
+        while ((cnt = acquire(rem_sem, min, max, deadline, false)) == 0 && min > 0 &&
+                is_closed.load(std::memory_order_acquire) && !drained()) {
+        }
+
+        if (cnt > 0) {
+            lock.run([&]() {
+                fifo.remove_n(pitems, cnt);
+                this->count_remove(cnt);
+            });
+
+            add_sem.post(cnt);
+        }
+
+        return cnt;
+    }
+
+    /*
+     * Removes an item from the FIFO and, if not null, moves data to 'pitem'.
      * If the FIFO is empty, call blocks until an element becomes available.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and all of
+     *         its elements have been removed.
      */
-    void remove_wait(T *pitem) {
-        sem_wait(rem_sem);
+    FIFOStatus remove_wait(T *pitem) {
+        return remove_wait_until(pitem, FIFODeadline::max());
+    }
 
-        pthread_mutex_lock(&mutex);
-        fifo.remove(pitem);
-        pthread_mutex_unlock(&mutex);
+    /*
+     * Same as 'remove_wait()', but gives up once 'deadline' (on the monotonic
+     * clock) passes, or after waiting for 'timeout'.
+     *
+     * return: Returns FIFO_OK if an element was removed, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and empty.
+     */
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline) {
+        while (acquire(rem_sem, 1, 1, deadline, false) == 0) {
+            if (!is_closed.load(std::memory_order_acquire)) {
+                return FIFO_TIMEOUT;
+            }
+
+            if (drained()) {
+                return FIFO_CLOSED;
+            }
+        }
+
+        lock.run([&]() {
+            fifo.remove(pitem);
+            this->count_remove(1);
+        });
+
+        add_sem.post();
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus remove_wait_for(T *pitem, const std::chrono::duration<Rep, Period> &timeout) {
+        return remove_wait_until(pitem, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Same as 'remove()', but first offers the head element to
+     * 'hook.drop_head(T &head, size_t remaining)', under the lock, with the
+     * number of elements behind it.  Returning true drops it (counted as evicted
+     * in 'stats()') and the next element is offered; the hook may move from
+     * 'head' when keeping it, and 'pitem' may then be null.  'hook.idle()' is
+     * called, also under the lock, whenever a remove empties the FIFO or finds it
+     * empty.  Used for active queue management (see FIFOBuff_TimedTS).  A
+     * consumer takes one unit of the element semaphore per element it removes or
+     * drops, so an element dropped at the head never leaves another consumer
+     * waiting for it.
+     *
+     * return: Returns false if the FIFO was empty (or everything in it was
+     *         dropped).
+     */
+    template <typename Hook>
+    bool remove(T *pitem, Hook &hook) {
+        if (rem_sem.try_wait() && take(pitem, hook)) {
+            return true;
+        }
+
+        found_empty(hook);
+
+        return false;
+    }
+
+    /*
+     * Same as 'remove_wait_until()', with the hook of the hooked 'remove()'.
+     * Dropped elements don't count.
+     */
+    template <typename Hook>
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline, Hook &hook) {
+        for (;;) {
+            if (!rem_sem.try_wait()) {
+                found_empty(hook);
+
+                if (acquire(rem_sem, 1, 1, deadline, false) == 0) {
+                    if (!is_closed.load(std::memory_order_acquire)) {
+                        return FIFO_TIMEOUT;
+                    }
+
+                    if (drained()) {
+                        return FIFO_CLOSED;
+                    }
+
+                    continue;
+                }
+            }
+
+            if (take(pitem, hook)) {
+                return FIFO_OK;
+            }
+        }
+    }
+
+    /*
+     * Closes the FIFO.  All threads blocked in the FIFO are woken.  Blocked and
+     * later adds fail with FIFO_CLOSED.  Removes keep returning the remaining
+     * elements, then report FIFO_CLOSED (end-of-stream) instead of blocking.
+     */
+    void close() {
+        lock.run([&]() {
+            is_closed.store(true, std::memory_order_release);
+        });
+
+        add_sem.close();
+        rem_sem.close();
+
+        if (event_fd >= 0) {
+            signal_event();
+        }
+    }
+
+    /*
+     * Returns true if 'close()' has been called.
+     */
+    bool closed() const {
+        return is_closed.load(std::memory_order_acquire);
+    }
 
-        sem_post(add_sem);
+    /*
+     * Same as FIFOBuff; a snapshot that any thread may take.
+     */
+    FIFOStatsData stats() const {
+        return Stats::read();
+    }
+
+    void reset_stats() {
+        Stats::reset();
+    }
+
+    /*
+     * Returns the number of elements the overflow policy has dropped (rejected,
+     * evicted or sampled out) so far; always zero with FIFOBlock.
+     */
+    size_t dropped() const {
+        return drop_cnt.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Returns the number of elements handed to FIFOSpill's secondary FIFO.
+     */
+    size_t spilled() const {
+        return spill_cnt.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Returns the overflow policy, e.g. to call FIFOSpill's 'set_target()'.  Call
+     * before the FIFO is shared between threads.
+     */
+    Overflow &overflow_policy() {
+        return *this;
     }
 };
 
@@ -0,0 +1,1014 @@
+/*
+ * File: fifobuff_bench.cpp
+ *
+ * Micro-benchmarks for the FIFO buffer classes in fifobuff.hpp.  Built only
+ * when Google Benchmark is installed (see CMakeLists.txt).
+ */
+#include <sched.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "fifobuff.hpp"
+#include "fifobuff_spsc.hpp"
+#include "fifobuff_mpmc.hpp"
+#include "fifobuff_pool.hpp"
+#include "fifobuff_sharded.hpp"
+#include "fifobuff_broadcast.hpp"
+#include "fifobuff_overwrite.hpp"
+
+#define BENCH_CAP 1024
+
+/*
+ * Single-threaded add/remove through a half-full FIFO so the ring indices keep
+ * wrapping.  Each iteration is one add plus one remove.
+ */
+template <typename FIFO>
+static void add_remove(benchmark::State &state, FIFO &fb) {
+    int     tmp = 0;
+
+    for (int i = 0; i < BENCH_CAP/2; i++) {
+        fb.add(i);
+    }
+
+    for (auto _ : state) {
+        fb.add(tmp);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_AddRemove_RuntimeCap(benchmark::State &state) {
+    size_t          cap = BENCH_CAP;
+
+    // Hide the capacity from the optimizer so it can't fold the modulo away.
+    benchmark::DoNotOptimize(cap);
+
+    FIFOBuff<int>   fb(cap);
+
+    add_remove(state, fb);
+}
+BENCHMARK(BM_AddRemove_RuntimeCap);
+
+static void BM_AddRemove_FixedCap(benchmark::State &state) {
+    FIFOBuff<int, BENCH_CAP>    fb;
+
+    add_remove(state, fb);
+}
+BENCHMARK(BM_AddRemove_FixedCap);
+
+/*
+ * Cost of the FIFOStats counters (compare with BM_AddRemove_FixedCap).
+ */
+static void BM_AddRemove_Stats(benchmark::State &state) {
+    FIFOBuff<int, BENCH_CAP, FIFOStats> fb;
+
+    add_remove(state, fb);
+}
+BENCHMARK(BM_AddRemove_Stats);
+
+/*
+ * Element of 'Size' bytes for the size/capacity matrix.
+ */
+template <size_t Size>
+struct Elem {
+    uint8_t     bytes[Size];
+};
+
+#define MATRIX_MAX_BYTES    (64 << 20)
+
+/*
+ * Single-threaded add/remove ns/op by element size (template parameter) and
+ * capacity ('state.range(0)', from 10 to 1M).  The FIFO is kept half full so the
+ * working set grows with the capacity.  Combinations over MATRIX_MAX_BYTES of
+ * buffer are left out.
+ */
+template <size_t Size>
+static void BM_AddRemove_Size(benchmark::State &state) {
+    FIFOBuff<Elem<Size>>    fb(state.range(0));
+    Elem<Size>              item;
+    Elem<Size>              tmp;
+
+    memset(&item, 1, sizeof(item));
+
+    for (size_t i = 0; i < fb.capacity() / 2; i++) {
+        fb.add(item);
+    }
+
+    for (auto _ : state) {
+        fb.add(item);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * Size);
+}
+
+template <size_t Size>
+static void matrix_caps(benchmark::internal::Benchmark *b) {
+    for (int64_t cap = 10; cap <= 1000000; cap *= 10) {
+        if (cap * Size <= MATRIX_MAX_BYTES) {
+            b->Arg(cap);
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_AddRemove_Size, 4)->Apply(matrix_caps<4>);
+BENCHMARK_TEMPLATE(BM_AddRemove_Size, 64)->Apply(matrix_caps<64>);
+BENCHMARK_TEMPLATE(BM_AddRemove_Size, 512)->Apply(matrix_caps<512>);
+BENCHMARK_TEMPLATE(BM_AddRemove_Size, 4096)->Apply(matrix_caps<4096>);
+
+/*
+ * Adding to a full FIFO, keeping the most recent elements: 'remove()' then
+ * 'add()' versus one 'add_overwrite()', and the lock-free FIFOBuff_Overwrite.
+ */
+static void BM_Overwrite_RemoveAdd(benchmark::State &state) {
+    FIFOBuff<std::string, BENCH_CAP>    fb;
+    std::string                         item(32, 'x');
+
+    while (fb.add(item)) {
+    }
+
+    for (auto _ : state) {
+        fb.remove(nullptr);
+        fb.add(item);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Overwrite_RemoveAdd);
+
+static void BM_Overwrite_AddOverwrite(benchmark::State &state) {
+    FIFOBuff<std::string, BENCH_CAP>    fb;
+    std::string                         item(32, 'x');
+
+    while (fb.add(item)) {
+    }
+
+    for (auto _ : state) {
+        fb.add_overwrite(item);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Overwrite_AddOverwrite);
+
+static void BM_Overwrite_LockFree(benchmark::State &state) {
+    FIFOBuff_Overwrite<int, BENCH_CAP>  fb;
+    int                                 i = 0;
+
+    for (auto _ : state) {
+        fb.add(i++);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Overwrite_LockFree);
+
+#define BULK_CNT 64
+
+/*
+ * Moving a burst of BULK_CNT elements in and out one element at a time versus
+ * with 'add_n()'/'remove_n()'.  Items processed counts elements, not calls.
+ */
+static void BM_Burst_Single(benchmark::State &state) {
+    FIFOBuff<int>   fb(BENCH_CAP);
+    int             items[BULK_CNT] = {0, };
+    int             tmp[BULK_CNT];
+
+    // Offset so the bursts straddle the wrap point.
+    fb.add_n(items, BULK_CNT/2);
+
+    for (auto _ : state) {
+        for (int i = 0; i < BULK_CNT; i++) {
+            fb.add(items[i]);
+        }
+
+        for (int i = 0; i < BULK_CNT; i++) {
+            fb.remove(&tmp[i]);
+        }
+
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BULK_CNT);
+}
+BENCHMARK(BM_Burst_Single);
+
+static void BM_Burst_Bulk(benchmark::State &state) {
+    FIFOBuff<int>   fb(BENCH_CAP);
+    int             items[BULK_CNT] = {0, };
+    int             tmp[BULK_CNT];
+
+    fb.add_n(items, BULK_CNT/2);
+
+    for (auto _ : state) {
+        fb.add_n(items, BULK_CNT);
+        fb.remove_n(tmp, BULK_CNT);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BULK_CNT);
+}
+BENCHMARK(BM_Burst_Bulk);
+
+/*
+ * Same as BM_Burst_Bulk by element size, with 'state.range(0)' elements per call.
+ */
+template <size_t Size>
+static void BM_Burst_BulkSize(benchmark::State &state) {
+    size_t                      n = state.range(0);
+    FIFOBuff<Elem<Size>>        fb(BENCH_CAP);
+    std::vector<Elem<Size>>     items(n);
+    std::vector<Elem<Size>>     tmp(n);
+
+    for (size_t i = 0; i < BENCH_CAP/2; i++) {
+        fb.add(items[0]);
+    }
+
+    for (auto _ : state) {
+        fb.add_n(items.data(), n);
+        fb.remove_n(tmp.data(), n);
+        benchmark::DoNotOptimize(tmp.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+    state.SetBytesProcessed(state.iterations() * n * Size);
+}
+BENCHMARK_TEMPLATE(BM_Burst_BulkSize, 4)->Arg(8)->Arg(64)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Burst_BulkSize, 64)->Arg(8)->Arg(64)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Burst_BulkSize, 512)->Arg(8)->Arg(64)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Burst_BulkSize, 4096)->Arg(8)->Arg(64)->Arg(256);
+
+#define READ_CAP 4096
+
+/*
+ * Bulk reads through 'data()'/'consume()' for the default heap storage versus
+ * mirrored storage.  Windows of 'state.range(0)' elements are summed in place;
+ * with heap storage a window that wraps must be read in two pieces.
+ */
+static void bulk_read(benchmark::State &state, FIFOStorage storage) {
+    FIFOBuff<int>               fb(READ_CAP, storage);
+    size_t                      win = state.range(0);
+    int                         items[READ_CAP] = {0, };
+    FIFOBuff<int>::span_pair_t  sp;
+    int                         sum = 0;
+
+    fb.add_n(items, fb.capacity() / 3);
+
+    for (auto _ : state) {
+        fb.add_n(items, win);
+        sp = fb.data();
+
+        for (size_t i = 0; i < std::min(win, sp.first.len); i++) {
+            sum += sp.first.ptr[i];
+        }
+
+        for (size_t i = 0; i < win - std::min(win, sp.first.len); i++) {
+            sum += sp.second.ptr[i];
+        }
+
+        fb.consume(win);
+        benchmark::DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * win);
+}
+
+static void BM_BulkRead_Heap(benchmark::State &state) {
+    bulk_read(state, FIFO_HEAP);
+}
+BENCHMARK(BM_BulkRead_Heap)->Arg(7)->Arg(100)->Arg(1000);
+
+static void BM_BulkRead_Mirrored(benchmark::State &state) {
+    bulk_read(state, FIFO_MIRRORED);
+}
+BENCHMARK(BM_BulkRead_Mirrored)->Arg(7)->Arg(100)->Arg(1000);
+
+/*
+ * Cost of constructing and destroying a FIFOBuff_TS (including its
+ * synchronization objects).
+ */
+static void BM_TS_Construct(benchmark::State &state) {
+    for (auto _ : state) {
+        FIFOBuff_TS<int>    fb(BENCH_CAP);
+
+        benchmark::DoNotOptimize(&fb);
+    }
+}
+BENCHMARK(BM_TS_Construct);
+
+/*
+ * Uncontended FIFOBuff_TS add/remove from a single thread; nobody ever waits.
+ */
+static void BM_TS_AddRemove(benchmark::State &state) {
+    FIFOBuff_TS<int>    fb(BENCH_CAP);
+    int                 tmp = 0;
+
+    for (auto _ : state) {
+        fb.add(tmp);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TS_AddRemove);
+
+static void BM_TS_AddRemove_Stats(benchmark::State &state) {
+    FIFOBuff_TS<int, 0, FIFOMutex, FIFOStats>   fb(BENCH_CAP);
+    int                                         tmp = 0;
+
+    for (auto _ : state) {
+        fb.add(tmp);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TS_AddRemove_Stats);
+
+static void BM_TS_AddRemoveWait(benchmark::State &state) {
+    FIFOBuff_TS<int>    fb(BENCH_CAP);
+    int                 tmp = 0;
+
+    for (auto _ : state) {
+        fb.add_wait(tmp);
+        fb.remove_wait(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TS_AddRemoveWait);
+
+/*
+ * Baseline: a standard container guarded by a std::mutex, bounded like the FIFOs
+ * and blocking on condition variables.
+ */
+template <typename Queue>
+class MutexQueue {
+    Queue                   queue;
+    size_t                  max_cap;
+    std::mutex              mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+
+public:
+    MutexQueue(size_t max_cap) : max_cap(max_cap) {}
+
+    template <typename T>
+    bool add(const T &item) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (queue.size() >= max_cap) {
+            return false;
+        }
+
+        queue.push_back(item);
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    template <typename T>
+    bool remove(T *pitem) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (queue.empty()) {
+            return false;
+        }
+
+        *pitem = queue.front();
+        queue.pop_front();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    template <typename T>
+    void add_wait(const T &item) {
+        std::unique_lock<std::mutex>    lock(mutex);
+
+        not_full.wait(lock, [this]() { return queue.size() < max_cap; });
+        queue.push_back(item);
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    template <typename T>
+    void remove_wait(T *pitem) {
+        std::unique_lock<std::mutex>    lock(mutex);
+
+        not_empty.wait(lock, [this]() { return !queue.empty(); });
+        *pitem = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+    }
+};
+
+/*
+ * std::queue only has push()/pop(); adapt it to the push_back()/pop_front() that
+ * MutexQueue uses.
+ */
+template <typename T>
+struct StdQueue : std::queue<T> {
+    void push_back(const T &item) {
+        this->push(item);
+    }
+
+    void pop_front() {
+        this->pop();
+    }
+};
+
+static void BM_StdQueue_AddRemove(benchmark::State &state) {
+    MutexQueue<StdQueue<int>>   fb(BENCH_CAP);
+    int                         tmp = 0;
+
+    for (auto _ : state) {
+        fb.add(tmp);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StdQueue_AddRemove);
+
+static void BM_StdDeque_AddRemove(benchmark::State &state) {
+    MutexQueue<std::deque<int>> fb(BENCH_CAP);
+    int                         tmp = 0;
+
+    for (auto _ : state) {
+        fb.add(tmp);
+        fb.remove(&tmp);
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StdDeque_AddRemove);
+
+#define HANDOFF_CAP 1024
+#define HANDOFF_CNT 100000
+
+/*
+ * Blocking put/take used by the thread handoff benchmarks.  FIFOs without
+ * blocking calls spin (yielding so this also works with few cores).
+ */
+template <typename FIFO, typename T>
+static void put(FIFO &fb, const T &item) {
+    fb.add_wait(item);
+}
+
+template <typename FIFO, typename T>
+static void take(FIFO &fb, T *pitem) {
+    fb.remove_wait(pitem);
+}
+
+template <typename T, size_t N>
+static void put(FIFOBuff_SPSC<T, N> &fb, const T &item) {
+    while (!fb.add(item)) {
+        sched_yield();
+    }
+}
+
+template <typename T, size_t N>
+static void take(FIFOBuff_SPSC<T, N> &fb, T *pitem) {
+    while (!fb.remove(pitem)) {
+        sched_yield();
+    }
+}
+
+/*
+ * One producer thread handing HANDOFF_CNT elements to one consumer thread.
+ */
+template <typename FIFO>
+static void handoff_1to1(benchmark::State &state, FIFO &fb) {
+    int     tmp;
+
+    for (auto _ : state) {
+        std::thread producer([&fb]() {
+            for (int i = 0; i < HANDOFF_CNT; i++) {
+                put(fb, i);
+            }
+        });
+
+        for (int i = 0; i < HANDOFF_CNT; i++) {
+            take(fb, &tmp);
+        }
+
+        producer.join();
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT);
+}
+
+static void BM_Handoff1to1_TS(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP>   fb;
+
+    handoff_1to1(state, fb);
+}
+BENCHMARK(BM_Handoff1to1_TS)->UseRealTime();
+
+static void BM_Handoff1to1_TS_Spin(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP>   fb;
+
+    fb.set_wait_policy(FIFOWaitPolicy(4000, 4, true));
+    handoff_1to1(state, fb);
+}
+BENCHMARK(BM_Handoff1to1_TS_Spin)->UseRealTime();
+
+/*
+ * Same as BM_Handoff1to1_TS, but the consumer drains up to 'state.range(0)'
+ * elements per 'remove_wait_bulk()' call, waiting for at least half that many.
+ */
+static void BM_Handoff1to1_TS_Bulk(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP>   fb;
+    size_t                          max = state.range(0);
+    std::vector<int>                tmp(max);
+
+    for (auto _ : state) {
+        std::thread producer([&fb]() {
+            for (int i = 0; i < HANDOFF_CNT; i++) {
+                fb.add_wait(i);
+            }
+        });
+
+        for (int i = 0; i < HANDOFF_CNT; ) {
+            i += fb.remove_wait_bulk(tmp.data(), max, std::min<size_t>(max/2, HANDOFF_CNT - i));
+        }
+
+        producer.join();
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT);
+}
+BENCHMARK(BM_Handoff1to1_TS_Bulk)->Arg(8)->Arg(64)->UseRealTime();
+
+/*
+ * The producer adds batches of 'state.range(0)' elements with 'add_wait_bulk()';
+ * the consumer drains whatever is available with 'remove_wait_bulk()'.
+ */
+static void BM_Handoff1to1_TS_AddBulk(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP>   fb;
+    int                             batch = state.range(0);
+
+    for (auto _ : state) {
+        std::thread producer([&fb, batch]() {
+            std::vector<int>    items(batch);
+
+            for (int i = 0; i < HANDOFF_CNT; i += batch) {
+                fb.add_wait_bulk(items.data(), std::min(batch, HANDOFF_CNT - i));
+            }
+        });
+
+        std::vector<int>    tmp(HANDOFF_CAP);
+
+        for (int i = 0; i < HANDOFF_CNT; ) {
+            i += fb.remove_wait_bulk(tmp.data(), HANDOFF_CAP, 1);
+        }
+
+        producer.join();
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT);
+}
+BENCHMARK(BM_Handoff1to1_TS_AddBulk)->Arg(1)->Arg(8)->Arg(64)->Arg(512)->UseRealTime();
+
+static void BM_Handoff1to1_SPSC(benchmark::State &state) {
+    FIFOBuff_SPSC<int, HANDOFF_CAP> fb;
+
+    handoff_1to1(state, fb);
+}
+BENCHMARK(BM_Handoff1to1_SPSC)->UseRealTime();
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * 'state.range(0)' producers hand HANDOFF_CNT timestamped elements to
+ * 'state.range(1)' consumers, which stop on a zero (poison) element.  Reports
+ * throughput plus p50/p99/p99.9/max of the add-to-remove latency.
+ */
+template <typename FIFO>
+static void handoff_mxn(benchmark::State &state, FIFO &fb) {
+    int                                 nprod = state.range(0);
+    int                                 ncons = state.range(1);
+    std::vector<std::vector<uint64_t>>  lat(ncons);
+    std::vector<uint64_t>               all;
+
+    for (auto _ : state) {
+        std::vector<std::thread>    threads;
+
+        for (int c = 0; c < ncons; c++) {
+            threads.emplace_back([&fb, &lat, c]() {
+                uint64_t    stamp = 0;
+
+                for (;;) {
+                    take(fb, &stamp);
+
+                    if (stamp == 0) {
+                        break;
+                    }
+
+                    lat[c].push_back(now_ns() - stamp);
+                }
+            });
+        }
+
+        for (int p = 0; p < nprod; p++) {
+            threads.emplace_back([&fb, nprod]() {
+                for (int i = 0; i < HANDOFF_CNT / nprod; i++) {
+                    put(fb, now_ns());
+                }
+            });
+        }
+
+        for (int p = 0; p < nprod; p++) {
+            threads[ncons + p].join();
+        }
+
+        for (int c = 0; c < ncons; c++) {
+            put(fb, (uint64_t)0);
+        }
+
+        for (int c = 0; c < ncons; c++) {
+            threads[c].join();
+        }
+    }
+
+    for (int c = 0; c < ncons; c++) {
+        all.insert(all.end(), lat[c].begin(), lat[c].end());
+    }
+
+    std::sort(all.begin(), all.end());
+
+    state.SetItemsProcessed(all.size());
+
+    if (!all.empty()) {
+        state.counters["p50_ns"] = all[all.size() / 2];
+        state.counters["p99_ns"] = all[all.size() * 99 / 100];
+        state.counters["p99.9_ns"] = all[all.size() * 999 / 1000];
+        state.counters["max_ns"] = all.back();
+    }
+}
+
+static void BM_HandoffMxN_TS(benchmark::State &state) {
+    FIFOBuff_TS<uint64_t, HANDOFF_CAP>  fb;
+
+    handoff_mxn(state, fb);
+}
+BENCHMARK(BM_HandoffMxN_TS)->ArgsProduct({{1, 4, 32}, {1, 4, 32}})->UseRealTime();
+
+static void BM_HandoffMxN_MPMC(benchmark::State &state) {
+    FIFOBuff_MPMC<uint64_t, HANDOFF_CAP>    fb;
+
+    handoff_mxn(state, fb);
+}
+BENCHMARK(BM_HandoffMxN_MPMC)->ArgsProduct({{1, 4, 32}, {1, 4, 32}})->UseRealTime();
+
+static void BM_HandoffMxN_StdQueue(benchmark::State &state) {
+    MutexQueue<StdQueue<uint64_t>>  fb(HANDOFF_CAP);
+
+    handoff_mxn(state, fb);
+}
+BENCHMARK(BM_HandoffMxN_StdQueue)->ArgsProduct({{1, 4, 32}, {1, 4, 32}})->UseRealTime();
+
+static void BM_HandoffMxN_StdDeque(benchmark::State &state) {
+    MutexQueue<std::deque<uint64_t>>    fb(HANDOFF_CAP);
+
+    handoff_mxn(state, fb);
+}
+BENCHMARK(BM_HandoffMxN_StdDeque)->ArgsProduct({{1, 4, 32}, {1, 4, 32}})->UseRealTime();
+
+/*
+ * 'state.range(0)' producers and as many consumers move HANDOFF_CNT elements;
+ * consumers stop once all have been taken (no poison, since order across lanes
+ * is relaxed).  Throughput only.
+ */
+template <typename FIFO>
+static void relaxed_mxn(benchmark::State &state, FIFO &fb) {
+    int     nthreads = state.range(0);
+
+    for (auto _ : state) {
+        std::vector<std::thread>    threads;
+        std::atomic<int>            taken(0);
+
+        for (int c = 0; c < nthreads; c++) {
+            threads.emplace_back([&fb, &taken]() {
+                int     tmp;
+
+                while (taken.load(std::memory_order_relaxed) < HANDOFF_CNT) {
+                    if (fb.remove(&tmp)) {
+                        taken.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else {
+                        sched_yield();
+                    }
+                }
+            });
+        }
+
+        for (int p = 0; p < nthreads; p++) {
+            threads.emplace_back([&fb, nthreads, p]() {
+                for (int i = p; i < HANDOFF_CNT; i += nthreads) {
+                    put(fb, i);
+                }
+            });
+        }
+
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT);
+}
+
+static void BM_Relaxed_TS(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP>   fb;
+
+    relaxed_mxn(state, fb);
+}
+BENCHMARK(BM_Relaxed_TS)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Arg(16)->UseRealTime();
+
+/*
+ * Same total capacity as BM_Relaxed_TS, split over 'state.range(1)' lanes.
+ */
+static void BM_Relaxed_Sharded(benchmark::State &state) {
+    FIFOBuff_Sharded<int>   fb(state.range(1), HANDOFF_CAP / state.range(1));
+
+    relaxed_mxn(state, fb);
+}
+BENCHMARK(BM_Relaxed_Sharded)->ArgsProduct({{1, 2, 4, 8, 16}, {1, 2, 4, 8, 16}})->UseRealTime();
+
+/*
+ * FIFOBuff_TS with the mutex and flat-combining policies, from 2 to 64 threads
+ * (half producers, half consumers).
+ */
+static void BM_Contended_Mutex(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP, FIFOMutex>    fb;
+
+    relaxed_mxn(state, fb);
+}
+BENCHMARK(BM_Contended_Mutex)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+
+static void BM_Contended_Combiner(benchmark::State &state) {
+    FIFOBuff_TS<int, HANDOFF_CAP, FIFOCombiner> fb;
+
+    relaxed_mxn(state, fb);
+}
+BENCHMARK(BM_Contended_Combiner)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
+
+/*
+ * One producer delivering HANDOFF_CNT elements to each of 'state.range(0)'
+ * subscriber threads: through one FIFOBuff_Broadcast, and (baseline) by copying
+ * each element into a FIFOBuff_SPSC per subscriber.  Items are deliveries.
+ */
+static void BM_Fanout_Broadcast(benchmark::State &state) {
+    int     nsubs = state.range(0);
+
+    for (auto _ : state) {
+        FIFOBuff_Broadcast<int, HANDOFF_CAP>    fb(nsubs);
+        std::vector<std::thread>                threads;
+
+        for (int s = 0; s < nsubs; s++) {
+            int     sub = fb.subscribe();
+
+            threads.emplace_back([&fb, sub]() {
+                int     tmp;
+
+                do {
+                    fb.read_wait(sub, &tmp);
+                } while (tmp != HANDOFF_CNT - 1);
+            });
+        }
+
+        for (int i = 0; i < HANDOFF_CNT; i++) {
+            fb.add_wait(i);
+        }
+
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT * nsubs);
+}
+BENCHMARK(BM_Fanout_Broadcast)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+static void BM_Fanout_SPSC(benchmark::State &state) {
+    int     nsubs = state.range(0);
+
+    for (auto _ : state) {
+        std::vector<FIFOBuff_SPSC<int, HANDOFF_CAP>>    fbs(nsubs);
+        std::vector<std::thread>                        threads;
+
+        for (int s = 0; s < nsubs; s++) {
+            FIFOBuff_SPSC<int, HANDOFF_CAP>     *pfb = &fbs[s];
+
+            threads.emplace_back([pfb]() {
+                int     tmp;
+
+                do {
+                    take(*pfb, &tmp);
+                } while (tmp != HANDOFF_CNT - 1);
+            });
+        }
+
+        for (int i = 0; i < HANDOFF_CNT; i++) {
+            for (int s = 0; s < nsubs; s++) {
+                put(fbs[s], i);
+            }
+        }
+
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * HANDOFF_CNT * nsubs);
+}
+BENCHMARK(BM_Fanout_SPSC)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+/*
+ * Baseline for FIFOPool: every worker takes jobs from, and jobs submit to, one
+ * shared FIFOBuff_TS.
+ */
+class SharedPool {
+    FIFOBuff_TS<FIFOJob*>       queue;
+    std::vector<std::thread>    threads;
+
+public:
+    SharedPool(size_t nthreads, size_t cap) : queue(cap) {
+        for (size_t i = 0; i < nthreads; i++) {
+            threads.emplace_back([this]() {
+                FIFOJob     *job = nullptr;
+
+                while (queue.remove_wait(&job) == FIFO_OK) {
+                    job->run(job);
+                }
+            });
+        }
+    }
+
+    ~SharedPool() {
+        queue.close();
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+
+    void submit(FIFOJob *job) {
+        queue.add_wait(job);
+    }
+};
+
+#define POOL_DEPTH      16
+#define POOL_JOBS       ((2 << POOL_DEPTH) - 1)
+#define POOL_WORK       64
+
+/*
+ * Jobs of a binary tree POOL_DEPTH deep; each job spins for POOL_WORK iterations
+ * and submits its two children from inside the pool.
+ */
+template <typename Pool>
+struct TreeJob : FIFOJob {
+    struct tree_t {
+        Pool                    *pool;
+        std::vector<TreeJob>    jobs;
+        std::atomic<int>        next;
+        std::atomic<int>        done;
+    };
+
+    tree_t  *tree;
+    int     depth;
+
+    static void spin() {
+        for (int i = 0; i < POOL_WORK; i++) {
+            benchmark::DoNotOptimize(i);
+        }
+    }
+
+    static void run_tree(FIFOJob *job) {
+        TreeJob     *tj = static_cast<TreeJob*>(job);
+        tree_t      *tree = tj->tree;
+
+        spin();
+
+        if (tj->depth > 0) {
+            TreeJob     *kids = &tree->jobs[tree->next.fetch_add(2, std::memory_order_relaxed)];
+
+            for (int i = 0; i < 2; i++) {
+                kids[i].run = run_tree;
+                kids[i].tree = tree;
+                kids[i].depth = tj->depth - 1;
+                tree->pool->submit(&kids[i]);
+            }
+        }
+
+        tree->done.fetch_add(1, std::memory_order_release);
+    }
+
+    static void run_flat(FIFOJob *job) {
+        spin();
+        static_cast<TreeJob*>(job)->tree->done.fetch_add(1, std::memory_order_release);
+    }
+};
+
+/*
+ * 'spawn' runs the job tree (jobs submitted by jobs); otherwise the benchmark
+ * thread submits POOL_JOBS independent jobs from outside the pool.
+ */
+template <typename Pool>
+static void pool_run(benchmark::State &state, Pool &pool, bool spawn) {
+    typename TreeJob<Pool>::tree_t  tree;
+
+    tree.pool = &pool;
+    tree.jobs.resize(POOL_JOBS);
+
+    for (auto _ : state) {
+        tree.next.store(1, std::memory_order_relaxed);
+        tree.done.store(0, std::memory_order_relaxed);
+
+        if (spawn) {
+            tree.jobs[0].run = TreeJob<Pool>::run_tree;
+            tree.jobs[0].tree = &tree;
+            tree.jobs[0].depth = POOL_DEPTH;
+            pool.submit(&tree.jobs[0]);
+        }
+        else {
+            for (int i = 0; i < POOL_JOBS; i++) {
+                tree.jobs[i].run = TreeJob<Pool>::run_flat;
+                tree.jobs[i].tree = &tree;
+                pool.submit(&tree.jobs[i]);
+            }
+        }
+
+        while (tree.done.load(std::memory_order_acquire) < POOL_JOBS) {
+            sched_yield();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * POOL_JOBS);
+}
+
+/*
+ * Thread counts from 1 to all cores, doubling.
+ */
+static void pool_threads(benchmark::internal::Benchmark *b) {
+    int     max = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int t = 1; t < max; t *= 2) {
+        b->Arg(t);
+    }
+
+    b->Arg(max);
+}
+
+static void BM_Pool_Spawn_Shared(benchmark::State &state) {
+    SharedPool  pool(state.range(0), POOL_JOBS + 1);
+
+    pool_run(state, pool, true);
+}
+BENCHMARK(BM_Pool_Spawn_Shared)->Apply(pool_threads)->UseRealTime();
+
+static void BM_Pool_Spawn_WS(benchmark::State &state) {
+    FIFOPool    pool(state.range(0));
+
+    pool_run(state, pool, true);
+}
+BENCHMARK(BM_Pool_Spawn_WS)->Apply(pool_threads)->UseRealTime();
+
+static void BM_Pool_Inject_Shared(benchmark::State &state) {
+    SharedPool  pool(state.range(0), BENCH_CAP);
+
+    pool_run(state, pool, false);
+}
+BENCHMARK(BM_Pool_Inject_Shared)->Apply(pool_threads)->UseRealTime();
+
+static void BM_Pool_Inject_WS(benchmark::State &state) {
+    FIFOPool    pool(state.range(0), BENCH_CAP);
+
+    pool_run(state, pool, false);
+}
+BENCHMARK(BM_Pool_Inject_WS)->Apply(pool_threads)->UseRealTime();
+
+BENCHMARK_MAIN();
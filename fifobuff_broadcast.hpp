@@ -0,0 +1,493 @@
+/*
+ * File: fifobuff_broadcast.hpp
+ *
+ * Provides a fixed-sized, single-producer ring buffer that delivers every
+ * element to each of several subscribers.
+ *
+ */
+#ifndef __FIFOBUFF_BROADCAST_HPP__
+#define __FIFOBUFF_BROADCAST_HPP__
+
+#include <sched.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "fifobuff.hpp"
+
+/*
+ * Default wait policy of FIFOBuff_Broadcast: a short spin and a few yields before
+ * parking.
+ */
+#ifndef FIFOBUFF_BROADCAST_SPIN
+#define FIFOBUFF_BROADCAST_SPIN     64
+#endif
+
+#ifndef FIFOBUFF_BROADCAST_YIELDS
+#define FIFOBUFF_BROADCAST_YIELDS   64
+#endif
+
+/*
+ * What the producer does when the ring is full because a subscriber hasn't read
+ * the oldest element yet.
+ */
+enum FIFOSlowPolicy {
+    FIFO_SLOW_BLOCK,    // Producer waits ('add()' fails) until the slowest subscriber reads.
+    FIFO_SLOW_DROP      // Producer skips lagging subscribers ahead; they're flagged.
+};
+
+/*
+ * Broadcast FIFO Buffer Class
+ *
+ * Disruptor-style ring: one producer adds elements, and each subscriber reads
+ * all of them in order through its own cursor, so the element is stored once no
+ * matter how many subscribers there are.  A slot is reused once every subscriber
+ * has read past it.  Only the producer writes the ring; subscribers only write
+ * their own cursor (on its own cache line), so subscribers don't contend with each
+ * other at all.  The producer caches the slowest cursor and only rescans the
+ * subscribers when the ring looks full.
+ *
+ * With FIFO_SLOW_DROP a slow subscriber never holds the producer up: when the ring
+ * is full, lagging subscribers are moved up to the oldest element still in the
+ * ring and 'lagged()' reports how many elements they missed.  A subscriber may be
+ * copying an element while it's overwritten (the copy is then thrown away and the
+ * read retried), so 'T' must be trivially copyable.
+ *
+ * Subscribers are numbered slots ('max_subs' of them), taken with 'subscribe()'.
+ * There must only be one producer thread, and one thread reading per subscriber.
+ *
+ * 'add_wait()'/'read_wait()' spin and yield as the FIFOWaitPolicy says, then park
+ * (see FIFOEventCount); a parked producer is woken every half lap the slowest
+ * subscriber reads.  'close()' (from any thread) ends the stream as with
+ * FIFOBuff_MPMC: adds fail, and each subscriber reads what's left before its
+ * 'read_wait()' reports FIFO_CLOSED.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ * param P: slow-subscriber policy.
+ */
+template <typename T, size_t N = 0, FIFOSlowPolicy P = FIFO_SLOW_BLOCK>
+class FIFOBuff_Broadcast : private FIFOCap<N> {
+    static_assert(P != FIFO_SLOW_DROP || std::is_trivially_copyable<T>::value,
+                  "FIFO_SLOW_DROP requires a trivially copyable element type");
+
+    typedef uint8_t item_mem_t[sizeof(T)];
+
+    /*
+     * Subscribers are kept in an array; the padding keeps each one's cursor off
+     * its neighbours' cache lines.
+     */
+    struct sub_t {
+        std::atomic<size_t> cursor;         // Next position to read.
+        std::atomic<bool>   active;
+        size_t              next;           // Reader's own idea of 'cursor'.
+        size_t              missed;         // Elements skipped (FIFO_SLOW_DROP).
+        uint8_t             pad[FIFOBUFF_CACHE_LINE];
+    };
+
+    item_mem_t              *buffer;
+    sub_t                   *subs;
+    size_t                  max_subs;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     tail;           // Positions added so far.
+    size_t                  min_cache;      // Producer's cached slowest cursor.
+    std::atomic<bool>       adding;         // Producer is in 'add()'; see 'close()'.
+    std::atomic<bool>       is_closed;
+    FIFOEventCount          room;           // Parks a blocked producer.
+    FIFOEventCount          items;          // Parks blocked subscribers.
+
+    void init(size_t nsubs) {
+        buffer = new item_mem_t[this->cap()];
+        subs = new sub_t[nsubs];
+        max_subs = nsubs;
+
+        for (size_t i = 0; i < nsubs; i++) {
+            subs[i].cursor.store(0, std::memory_order_relaxed);
+            subs[i].next = 0;
+            subs[i].missed = 0;
+            subs[i].active.store(false, std::memory_order_relaxed);
+        }
+
+        tail.store(0, std::memory_order_relaxed);
+        min_cache = 0;
+        adding.store(false, std::memory_order_relaxed);
+        is_closed.store(false, std::memory_order_relaxed);
+        room.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_BROADCAST_SPIN, FIFOBUFF_BROADCAST_YIELDS));
+        items.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_BROADCAST_SPIN, FIFOBUFF_BROADCAST_YIELDS));
+    }
+
+    T *slot(size_t pos) {
+        return reinterpret_cast<T*>(buffer[this->wrap(pos)]);
+    }
+
+    /*
+     * Returns the slowest active subscriber's cursor, or 'end' if there are none.
+     */
+    size_t slowest(size_t end) {
+        size_t  min = end;
+
+        // Pairs with 'subscribe()': either we see the subscriber, or it sees our tail.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (size_t i = 0; i < max_subs; i++) {
+            if (subs[i].active.load(std::memory_order_seq_cst)) {
+                min = std::min(min, subs[i].cursor.load(std::memory_order_acquire));
+            }
+        }
+
+        return min;
+    }
+
+    /*
+     * Moves every subscriber that would be overwritten by adding position 'pos'
+     * up to the oldest position that stays in the ring.
+     */
+    void drop_lagging(size_t pos) {
+        size_t  oldest = pos - this->cap() + 1;
+
+        for (size_t i = 0; i < max_subs; i++) {
+            size_t  c = subs[i].cursor.load(std::memory_order_acquire);
+
+            while (c < oldest && subs[i].active.load(std::memory_order_relaxed)) {
+                if (subs[i].cursor.compare_exchange_weak(c, oldest, std::memory_order_acq_rel)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    /*
+     * Called when subscriber 'sub' found nothing to read in a closed FIFO.  An
+     * add that started before 'close()' may not have published its element yet.
+     *
+     * return: Returns true if no elements remain for 'sub'.
+     */
+    bool drained(int sub) {
+        if (adding.load(std::memory_order_seq_cst)) {
+            sched_yield();
+
+            return false;
+        }
+
+        return backlog(sub) == 0;
+    }
+
+    static bool expired(FIFODeadline deadline) {
+        return deadline != FIFODeadline::max() && FIFOClock::now() >= deadline;
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_Broadcast(size_t nsubs) : FIFOCap<N>(N) {
+        init(nsubs);
+    }
+
+    /*
+     * Construct a ring of 'max_cap' elements with room for 'nsubs' subscribers.
+     */
+    FIFOBuff_Broadcast(size_t max_cap, size_t nsubs) : FIFOCap<N>(max_cap) {
+        init(nsubs);
+    }
+
+    ~FIFOBuff_Broadcast() {
+        size_t  end = tail.load(std::memory_order_relaxed);
+
+        // Every slot written in the last lap still holds an element.
+        for (size_t pos = end > this->cap() ? end - this->cap() : 0; pos < end; pos++) {
+            slot(pos)->~T();
+        }
+
+        delete [] subs;
+        delete [] buffer;
+    }
+
+    size_t capacity() const {
+        return this->cap();
+    }
+
+    /*
+     * Takes a free subscriber slot.  The subscriber reads elements added from now
+     * on.
+     *
+     * return: Returns the subscriber number, or -1 if all are taken.
+     */
+    int subscribe() {
+        for (size_t i = 0; i < max_subs; i++) {
+            bool    expect = false;
+
+            if (!subs[i].active.load(std::memory_order_relaxed) &&
+                    subs[i].active.compare_exchange_strong(expect, true, std::memory_order_seq_cst)) {
+                size_t  c = subs[i].cursor.load(std::memory_order_relaxed);
+                size_t  t = tail.load(std::memory_order_seq_cst);
+
+                /*
+                 * Until the cursor is moved up to the tail, the producer sees the
+                 * previous subscriber's (older) cursor, which only makes it more
+                 * cautious.  Only move it forward: with FIFO_SLOW_DROP the producer
+                 * may have moved it already.
+                 */
+                while (c < t && !subs[i].cursor.compare_exchange_weak(c, t, std::memory_order_acq_rel)) {
+                }
+
+                subs[i].next = std::max(c, t);
+                subs[i].missed = 0;
+
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+    /*
+     * Releases a subscriber slot; the producer no longer waits for it.
+     */
+    void unsubscribe(int sub) {
+        subs[sub].active.store(false, std::memory_order_seq_cst);
+        room.notify();
+    }
+
+    /*
+     * Same as FIFOBuff_TS.  Call before the FIFO is shared between threads.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        room.set_wait_policy(policy);
+        items.set_wait_policy(policy);
+    }
+
+    /*
+     * Adds an element for all subscribers.  Producer only.
+     *
+     * return: Returns false if the slowest subscriber hasn't made room yet
+     *         (FIFO_SLOW_BLOCK only), or if the FIFO is closed.
+     */
+    bool add(const T &item) {
+        size_t  pos = tail.load(std::memory_order_relaxed);
+
+        // Pairs with 'close()': either it sees us adding, or we see it closed.
+        adding.store(true, std::memory_order_seq_cst);
+
+        if (is_closed.load(std::memory_order_seq_cst)) {
+            adding.store(false, std::memory_order_release);
+
+            return false;
+        }
+
+        if (pos - min_cache >= this->cap()) {
+            min_cache = slowest(pos);
+
+            if (pos - min_cache >= this->cap()) {
+                if (P == FIFO_SLOW_BLOCK) {
+                    adding.store(false, std::memory_order_release);
+
+                    return false;
+                }
+
+                drop_lagging(pos);
+                min_cache = pos - this->cap() + 1;
+            }
+        }
+
+        if (pos >= this->cap()) {
+            slot(pos)->~T();
+        }
+
+        new (slot(pos)) T(item);
+        tail.store(pos + 1, std::memory_order_release);
+        adding.store(false, std::memory_order_release);
+        items.notify_all();
+
+        return true;
+    }
+
+    /*
+     * Same as 'add()'; waits for room instead of failing.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait(const T &item) {
+        return add_wait_until(item, FIFODeadline::max());
+    }
+
+    /*
+     * Same as 'add_wait()', giving up at 'deadline'.
+     *
+     * return: Returns FIFO_OK if the element was added, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait_until(const T &item, FIFODeadline deadline) {
+        unsigned    step = 0;
+
+        while (!add(item)) {
+            if (closed()) {
+                return FIFO_CLOSED;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            room.await(step, [this]() {
+                size_t  pos = tail.load(std::memory_order_relaxed);
+
+                return closed() || pos - slowest(pos) < this->cap();
+            }, deadline);
+        }
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(const T &item, const std::chrono::duration<Rep, Period> &timeout) {
+        return add_wait_until(item, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Reads the next element for subscriber 'sub'.  The element stays in the ring
+     * for the other subscribers.
+     *
+     * return: Returns false if there's no new element.
+     */
+    bool read(int sub, T *pitem) {
+        sub_t   &s = subs[sub];
+        size_t  c = s.cursor.load(std::memory_order_relaxed);
+
+        if (P == FIFO_SLOW_BLOCK) {
+            if (c == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            *pitem = *slot(c);
+            s.cursor.store(c + 1, std::memory_order_release);
+
+            /*
+             * A parked producer waits for the slowest subscriber, which is a whole
+             * lap behind, so waking it every half lap is enough and keeps the
+             * fence off most reads.
+             */
+            if (this->wrap(c + 1) == 0 || this->wrap(c + 1) == this->cap() / 2) {
+                room.notify();
+            }
+
+            return true;
+        }
+
+        for (;;) {
+            item_mem_t  copy;
+
+            // Only the producer moves our cursor behind our back, when dropping us.
+            if (c != s.next) {
+                s.missed += c - s.next;
+                s.next = c;
+            }
+
+            if (c == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            /*
+             * The producer may overwrite the slot during the copy, but only after
+             * moving our cursor, in which case the CAS fails and we retry at the
+             * position it moved us to.
+             */
+            memcpy(copy, slot(c), sizeof(T));
+
+            if (s.cursor.compare_exchange_strong(c, c + 1, std::memory_order_acq_rel)) {
+                memcpy((void*)pitem, copy, sizeof(T));
+                s.next = c + 1;
+
+                return true;
+            }
+        }
+    }
+
+    /*
+     * Same as 'read()'; waits for an element instead of failing.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and 'sub' has
+     *         read all of its elements.
+     */
+    FIFOStatus read_wait(int sub, T *pitem) {
+        return read_wait_until(sub, pitem, FIFODeadline::max());
+    }
+
+    /*
+     * Same as 'read_wait()', giving up at 'deadline'.
+     *
+     * return: Returns FIFO_OK if an element was read, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and 'sub' has read everything.
+     */
+    FIFOStatus read_wait_until(int sub, T *pitem, FIFODeadline deadline) {
+        unsigned    step = 0;
+
+        while (!read(sub, pitem)) {
+            if (closed()) {
+                if (drained(sub)) {
+                    return FIFO_CLOSED;
+                }
+
+                continue;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            items.await(step, [this, sub]() { return closed() || backlog(sub) > 0; }, deadline);
+        }
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus read_wait_for(int sub, T *pitem, const std::chrono::duration<Rep, Period> &timeout) {
+        return read_wait_until(sub, pitem, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Returns the number of elements subscriber 'sub' missed since the last call,
+     * because the producer dropped it (FIFO_SLOW_DROP); non-zero means it lagged.
+     * Misses are noticed by 'read()', so after a successful read this counts those
+     * just before the element read.  Reader only.
+     */
+    size_t lagged(int sub) {
+        size_t  n = subs[sub].missed;
+
+        subs[sub].missed = 0;
+
+        return n;
+    }
+
+    /*
+     * Returns the number of elements subscriber 'sub' has yet to read.
+     */
+    size_t backlog(int sub) const {
+        return tail.load(std::memory_order_acquire) - subs[sub].cursor.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Same as FIFOBuff_MPMC: wakes all blocked threads; adds fail from then on,
+     * and subscribers read the remaining elements and then get FIFO_CLOSED.
+     */
+    void close() {
+        is_closed.store(true, std::memory_order_seq_cst);
+
+        // An add that didn't see the flag publishes its element before this returns.
+        while (adding.load(std::memory_order_seq_cst)) {
+            sched_yield();
+        }
+
+        room.notify_all();
+        items.notify_all();
+    }
+
+    /*
+     * Returns true if 'close()' has been called.
+     */
+    bool closed() const {
+        return is_closed.load(std::memory_order_acquire);
+    }
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include "gtest/gtest.h"
+#include "fifobuff_broadcast.hpp"
+
+#define CAP     10
+#define SUBS    3
+
+/*
+ * Test that every subscriber reads every element, and that with the blocking
+ * policy the slowest subscriber holds the producer up.
+ */
+TEST(FIFOBuffBroadcastTest, block) {
+    FIFOBuff_Broadcast<std::string> fb(CAP, SUBS);
+    int                             fast = fb.subscribe();
+    int                             slow = fb.subscribe();
+    std::string                     tmp;
+
+    ASSERT_GE(fast, 0);
+    ASSERT_GE(slow, 0);
+    ASSERT_FALSE(fb.read(fast, &tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.add(std::to_string(i)));
+    }
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.read(fast, &tmp));
+        ASSERT_EQ(std::to_string(i), tmp);
+    }
+
+    ASSERT_FALSE(fb.read(fast, &tmp));
+
+    // Slow subscriber hasn't read anything yet.
+    ASSERT_FALSE(fb.add("x"));
+    ASSERT_EQ((size_t)CAP, fb.backlog(slow));
+
+    ASSERT_TRUE(fb.read(slow, &tmp));
+    ASSERT_EQ("0", tmp);
+    ASSERT_TRUE(fb.add(std::to_string(CAP)));
+    ASSERT_FALSE(fb.add("x"));
+
+    // A new subscriber only sees what's added after it subscribed.
+    fb.unsubscribe(slow);
+    slow = fb.subscribe();
+    ASSERT_EQ(0u, fb.backlog(slow));
+
+    ASSERT_TRUE(fb.add(std::to_string(CAP+1)));
+    ASSERT_TRUE(fb.read(slow, &tmp));
+    ASSERT_EQ(std::to_string(CAP+1), tmp);
+
+    ASSERT_TRUE(fb.read(fast, &tmp));
+    ASSERT_EQ(std::to_string(CAP), tmp);
+}
+
+/*
+ * Test that with the drop policy the producer never waits, and that the lagging
+ * subscriber is moved up to the oldest element and told how many it missed.
+ */
+TEST(FIFOBuffBroadcastTest, drop) {
+    FIFOBuff_Broadcast<int, 0, FIFO_SLOW_DROP>  fb(CAP, SUBS);
+    int                                         sub = fb.subscribe();
+    int                                         tmp;
+
+    for (int i = 0; i < CAP + 5; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    // Noticed by the first read after being dropped.
+    ASSERT_EQ(0u, fb.lagged(sub));
+    ASSERT_TRUE(fb.read(sub, &tmp));
+    ASSERT_EQ(5, tmp);
+    ASSERT_EQ(5u, fb.lagged(sub));
+    ASSERT_EQ(0u, fb.lagged(sub));
+
+    for (int i = 6; i < CAP + 5; i++) {
+        ASSERT_TRUE(fb.read(sub, &tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.read(sub, &tmp));
+    ASSERT_EQ(0u, fb.lagged(sub));
+}
+
+#define PRODUCTS        100000
+
+struct sub_arg {
+    void    *fb;
+    int     sub;
+    long    bad;
+    long    got;
+};
+
+template <typename FIFO>
+static void *subscriber(void *arg) {
+    sub_arg *sa = (sub_arg*)arg;
+    FIFO    *pfb = (FIFO*)sa->fb;
+    int     expect = 0;
+    int     tmp;
+
+    do {
+        if (pfb->read_wait(sa->sub, &tmp) != FIFO_OK) {
+            sa->bad++;
+            break;
+        }
+
+        // Skipped elements must be accounted for by 'lagged()'.
+        expect += pfb->lagged(sa->sub);
+
+        if (tmp != expect) {
+            sa->bad++;
+        }
+
+        expect = tmp + 1;
+        sa->got++;
+    } while (tmp != PRODUCTS - 1);
+
+    return nullptr;
+}
+
+template <typename FIFO>
+static void broadcast_threaded(FIFO &fb, bool lossless) {
+    pthread_t   threads[SUBS];
+    sub_arg     args[SUBS];
+
+    for (int i = 0; i < SUBS; i++) {
+        args[i].fb = &fb;
+        args[i].sub = fb.subscribe();
+        args[i].bad = 0;
+        args[i].got = 0;
+        pthread_create(&threads[i], nullptr, subscriber<FIFO>, &args[i]);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        fb.add_wait(i);
+    }
+
+    for (int i = 0; i < SUBS; i++) {
+        pthread_join(threads[i], nullptr);
+        ASSERT_EQ(0, args[i].bad);
+
+        if (lossless) {
+            ASSERT_EQ(PRODUCTS, args[i].got);
+        }
+    }
+}
+
+/*
+ * Test one producer and several subscriber threads.
+ */
+TEST(FIFOBuffBroadcastTest, threaded_block) {
+    FIFOBuff_Broadcast<int, 64> fb(SUBS);
+
+    broadcast_threaded(fb, true);
+}
+
+TEST(FIFOBuffBroadcastTest, threaded_drop) {
+    FIFOBuff_Broadcast<int, 64, FIFO_SLOW_DROP> fb(SUBS);
+
+    broadcast_threaded(fb, false);
+}
+
+static FIFOBuff_Broadcast<int>  close_fb(CAP, SUBS);
+static int                      close_sub;
+static int                      close_got;
+
+static void *close_reader(void *) {
+    int     tmp;
+
+    while (close_fb.read_wait(close_sub, &tmp) == FIFO_OK) {
+        close_got++;
+    }
+
+    return nullptr;
+}
+
+static void *closer(void *arg) {
+    usleep(20000);
+    ((FIFOBuff_Broadcast<int>*)arg)->close();
+
+    return nullptr;
+}
+
+/*
+ * Test timed waits, and that 'close()' releases a subscriber blocked in
+ * 'read_wait()' once it has read what's left, and a producer blocked in
+ * 'add_wait()'.
+ */
+TEST(FIFOBuffBroadcastTest, close) {
+    FIFOBuff_Broadcast<int> full(CAP, SUBS);
+    pthread_t               thread;
+    int                     tmp;
+
+    close_sub = close_fb.subscribe();
+    ASSERT_EQ(FIFO_TIMEOUT, close_fb.read_wait_for(close_sub, &tmp, std::chrono::milliseconds(5)));
+
+    pthread_create(&thread, nullptr, close_reader, nullptr);
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(FIFO_OK, close_fb.add_wait(i));
+    }
+
+    // Let the reader park on an empty ring before closing.
+    usleep(20000);
+    close_fb.close();
+    pthread_join(thread, nullptr);
+
+    ASSERT_TRUE(close_fb.closed());
+    ASSERT_EQ(CAP, close_got);
+    ASSERT_FALSE(close_fb.add(13));
+    ASSERT_EQ(FIFO_CLOSED, close_fb.add_wait(13));
+    ASSERT_EQ(FIFO_CLOSED, close_fb.read_wait(close_sub, &tmp));
+
+    // A producer held up by a subscriber that never reads.
+    full.subscribe();
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(full.add(i));
+    }
+
+    ASSERT_EQ(FIFO_TIMEOUT, full.add_wait_for(13, std::chrono::milliseconds(5)));
+
+    pthread_create(&thread, nullptr, closer, &full);
+
+    ASSERT_EQ(FIFO_CLOSED, full.add_wait(13));
+    pthread_join(thread, nullptr);
+}
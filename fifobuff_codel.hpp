@@ -0,0 +1,485 @@
+/*
+ * File: fifobuff_codel.hpp
+ *
+ * Provides FIFO buffers that timestamp each element as it's added, report how
+ * long it waited (its sojourn time) when it's removed, and can drop elements at
+ * the head to keep that time bounded (CoDel).
+ *
+ */
+#ifndef __FIFOBUFF_CODEL_HPP__
+#define __FIFOBUFF_CODEL_HPP__
+
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include "fifobuff.hpp"
+
+/*
+ * Active Queue Management Policies
+ *
+ * Passed as the 'AQM' template parameter of FIFOBuff_Timed.  'drop_head()' is
+ * called for the element at the head of the FIFO each time one is about to be
+ * removed, with its sojourn time and the number of elements behind it; returning
+ * true drops it and the next element is offered.  'idle()' is called when a
+ * remove finds the FIFO empty.
+ *
+ * FIFONoAQM never drops.
+ */
+struct FIFONoAQM {
+    bool drop_head(FIFODeadline, std::chrono::nanoseconds, size_t) {
+        return false;
+    }
+
+    void idle() {}
+};
+
+/*
+ * CoDel ("Controlled Delay", RFC 8289).  Drops nothing while the queue drains:
+ * only once every element removed during a whole 'interval' has waited longer
+ * than 'target' (a standing queue, not a burst) does it start dropping at the
+ * head, at a rate that rises with the square root of the drops since, until the
+ * sojourn time falls below 'target' again.  An element is never dropped when it's
+ * the last in the FIFO.
+ */
+class FIFOCoDel {
+    std::chrono::nanoseconds    target;
+    std::chrono::nanoseconds    interval;
+    FIFODeadline                first_above;    // When the delay will have been above target for an interval.
+    FIFODeadline                drop_next;
+    uint32_t                    count;          // Drops since entering the dropping state.
+    uint32_t                    last_count;
+    bool                        dropping;
+
+    FIFODeadline control_law(FIFODeadline t) const {
+        return t + std::chrono::nanoseconds((int64_t)(interval.count() / sqrt((double)count)));
+    }
+
+public:
+    /*
+     * param target: acceptable standing queueing delay (RFC default 5ms).
+     * param interval: how long the delay must stay above 'target' before dropping
+     *                 (RFC default 100ms, about a round trip).
+     */
+    FIFOCoDel(std::chrono::nanoseconds target = std::chrono::milliseconds(5),
+              std::chrono::nanoseconds interval = std::chrono::milliseconds(100)) :
+            target(target), interval(interval), first_above(), drop_next(), count(0), last_count(0),
+            dropping(false) {
+    }
+
+    bool drop_head(FIFODeadline now, std::chrono::nanoseconds sojourn, size_t remaining) {
+        bool    ok_to_drop = false;
+
+        if (sojourn < target || remaining == 0) {
+            first_above = FIFODeadline();
+        }
+        else if (first_above == FIFODeadline()) {
+            first_above = now + interval;
+        }
+        else if (now >= first_above) {
+            ok_to_drop = true;
+        }
+
+        if (dropping) {
+            if (!ok_to_drop) {
+                dropping = false;
+            }
+            else if (now >= drop_next) {
+                count++;
+                drop_next = control_law(drop_next);
+
+                return true;
+            }
+
+            return false;
+        }
+
+        if (ok_to_drop) {
+            uint32_t    delta = count - last_count;
+
+            // Went back to dropping soon after leaving it: resume near the old rate.
+            dropping = true;
+            count = (delta > 1 && now - drop_next < 16 * interval) ? delta : 1;
+            drop_next = control_law(now);
+            last_count = count;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void idle() {
+        first_above = FIFODeadline();
+        dropping = false;
+    }
+};
+
+/*
+ * An element stored with the time it was added.  The stamp is taken when the
+ * element is constructed in the FIFO, so time a producer spends blocked on a
+ * full FIFO doesn't count as sojourn time.
+ */
+template <typename T>
+struct FIFOStamped {
+    T               item;
+    FIFODeadline    stamp;
+
+    template <typename... Args>
+    explicit FIFOStamped(Args&&... args) : item(std::forward<Args>(args)...), stamp(FIFOClock::now()) {}
+};
+
+/*
+ * Timestamped FIFO Buffer Class
+ *
+ * Same as FIFOBuff (not thread-safe), except each element is stored with the
+ * time it was added, and 'remove()' reports how long it waited.  The 'AQM'
+ * policy may drop elements at the head instead of returning them (see
+ * FIFOCoDel); 'dropped()' counts them.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ * param AQM: FIFONoAQM (default) or FIFOCoDel.
+ */
+template <typename T, size_t N = 0, typename AQM = FIFONoAQM>
+class FIFOBuff_Timed {
+    typedef FIFOStamped<T>  stamped_t;
+
+    FIFOBuff<stamped_t, N>  fifo;
+    AQM                     aqm;
+    size_t                  drop_cnt;
+
+    /*
+     * Removes the head element unless the AQM policy drops it.  The FIFO must not
+     * be empty.
+     *
+     * return: Returns true if the element was removed, false if it was dropped.
+     */
+    bool remove_head(T *pitem, std::chrono::nanoseconds *psojourn) {
+        stamped_t                   *head = fifo.data().first.ptr;
+        FIFODeadline                now = FIFOClock::now();
+        std::chrono::nanoseconds    sojourn = std::chrono::duration_cast<std::chrono::nanoseconds>(now - head->stamp);
+
+        if (aqm.drop_head(now, sojourn, fifo.size() - 1)) {
+            fifo.remove(nullptr);
+            drop_cnt++;
+
+            return false;
+        }
+
+        if (pitem != nullptr) {
+            *pitem = std::move(head->item);
+        }
+
+        if (psojourn != nullptr) {
+            *psojourn = sojourn;
+        }
+
+        fifo.remove(nullptr);
+
+        return true;
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_Timed(const AQM &aqm = AQM()) : aqm(aqm), drop_cnt(0) {
+    }
+
+    FIFOBuff_Timed(size_t max_cap, const AQM &aqm = AQM()) : fifo(max_cap), aqm(aqm), drop_cnt(0) {
+    }
+
+    size_t size() const {
+        return fifo.size();
+    }
+
+    size_t capacity() const {
+        return fifo.capacity();
+    }
+
+    /*
+     * Returns the number of elements dropped by the AQM policy so far.
+     */
+    size_t dropped() const {
+        return drop_cnt;
+    }
+
+    /*
+     * Same as FIFOBuff; the element is stamped with the current time.
+     */
+    bool add(const T &item) {
+        return emplace(item);
+    }
+
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        return fifo.emplace(std::forward<Args>(args)...);
+    }
+
+    /*
+     * Returns how long the head element has been waiting, or zero if empty.
+     */
+    std::chrono::nanoseconds head_sojourn() const {
+        typename FIFOBuff<stamped_t, N>::span_pair_t    sp = fifo.data();
+
+        if (sp.size() == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(FIFOClock::now() - sp.first.ptr->stamp);
+    }
+
+    /*
+     * Same as FIFOBuff, except elements the AQM policy drops are skipped.
+     *
+     * param psojourn: If not null, set to how long the removed element waited.
+     * return: Returns false if the FIFO was empty (or everything in it was
+     *         dropped).
+     */
+    bool remove(T *pitem, std::chrono::nanoseconds *psojourn = nullptr) {
+        while (fifo.size() > 0) {
+            if (remove_head(pitem, psojourn)) {
+                return true;
+            }
+        }
+
+        idle();
+
+        return false;
+    }
+
+    /*
+     * Tells the AQM policy the FIFO ran empty, which ends a standing queue (CoDel
+     * leaves its dropping state).  Called by 'remove()'.
+     */
+    void idle() {
+        aqm.idle();
+    }
+};
+
+/*
+ * Thread-safe version of FIFOBuff_Timed: a FIFOBuff_TS of FIFOStamped elements,
+ * so the blocking, timed-wait, 'close()', eventfd, stats, 'Sync' and 'Overflow'
+ * semantics are FIFOBuff_TS's.  Removes go through FIFOBuff_TS's dequeue hook,
+ * which hands each head element to the AQM policy under the FIFO's lock (also
+ * guarding the policy's state) and tells it when a remove empties the FIFO or
+ * finds it empty.  Elements the AQM policy drops count as evicted in 'stats()'.
+ *
+ * With FIFOSpill, the secondary FIFO is given the arguments of the add, not a
+ * FIFOStamped.
+ *
+ * param AQM: FIFONoAQM (default) or FIFOCoDel.
+ * param Sync, Stats, Overflow: same as FIFOBuff_TS.
+ */
+template <typename T, size_t N = 0, typename AQM = FIFONoAQM, typename Sync = FIFOMutex,
+          typename Stats = FIFONoStats, typename Overflow = FIFOBlock>
+class FIFOBuff_TimedTS {
+    typedef FIFOStamped<T>  stamped_t;
+
+    /*
+     * FIFOBuff_TS's dequeue hook for one remove; runs under the FIFO's lock.
+     */
+    struct hook_t {
+        FIFOBuff_TimedTS            *owner;
+        T                           *pitem;
+        std::chrono::nanoseconds    *psojourn;
+
+        bool drop_head(stamped_t &head, size_t remaining) {
+            FIFODeadline                now = FIFOClock::now();
+            std::chrono::nanoseconds    sojourn = std::chrono::duration_cast<std::chrono::nanoseconds>(now - head.stamp);
+
+            if (owner->aqm.drop_head(now, sojourn, remaining)) {
+                owner->drop_cnt.fetch_add(1, std::memory_order_relaxed);
+
+                return true;
+            }
+
+            if (pitem != nullptr) {
+                *pitem = std::move(head.item);
+            }
+
+            if (psojourn != nullptr) {
+                *psojourn = sojourn;
+            }
+
+            return false;
+        }
+
+        void idle() {
+            owner->aqm.idle();
+        }
+    };
+
+    FIFOBuff_TS<stamped_t, N, Sync, Stats, Overflow>    fifo;
+    AQM                                                 aqm;        // Guarded by the FIFO's lock.
+    std::atomic<size_t>                                 drop_cnt;
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_TimedTS(const AQM &aqm = AQM()) : aqm(aqm), drop_cnt(0) {
+    }
+
+    FIFOBuff_TimedTS(size_t max_cap, const AQM &aqm = AQM()) : fifo(max_cap), aqm(aqm), drop_cnt(0) {
+    }
+
+    /*
+     * Returns the number of elements dropped by the AQM policy so far.
+     */
+    size_t dropped() const {
+        return drop_cnt.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Returns the number of elements the overflow policy has shed; same as
+     * FIFOBuff_TS's 'dropped()'.
+     */
+    size_t overflow_dropped() const {
+        return fifo.dropped();
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     */
+    size_t spilled() const {
+        return fifo.spilled();
+    }
+
+    Overflow &overflow_policy() {
+        return fifo.overflow_policy();
+    }
+
+    int enable_event_fd(size_t watermark = 0) {
+        return fifo.enable_event_fd(watermark);
+    }
+
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        fifo.set_wait_policy(policy);
+    }
+
+    FIFOStatsData stats() const {
+        return fifo.stats();
+    }
+
+    void reset_stats() {
+        fifo.reset_stats();
+    }
+
+    /*
+     * Same as FIFOBuff_TS; the element is stamped when it enters the FIFO.
+     */
+    bool add(const T &item) {
+        return fifo.emplace(item);
+    }
+
+    bool add(T &&item) {
+        return fifo.emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        return fifo.emplace(std::forward<Args>(args)...);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait(const T &item) {
+        return fifo.emplace_wait(item);
+    }
+
+    FIFOStatus add_wait(T &&item) {
+        return fifo.emplace_wait(std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait(Args&&... args) {
+        return fifo.emplace_wait(std::forward<Args>(args)...);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if the element was added, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait_until(const T &item, FIFODeadline deadline) {
+        return fifo.emplace_wait_until(deadline, item);
+    }
+
+    FIFOStatus add_wait_until(T &&item, FIFODeadline deadline) {
+        return fifo.emplace_wait_until(deadline, std::move(item));
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(const T &item, const std::chrono::duration<Rep, Period> &timeout) {
+        return fifo.emplace_wait_until(FIFOClock::now() + timeout, item);
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(T &&item, const std::chrono::duration<Rep, Period> &timeout) {
+        return fifo.emplace_wait_until(FIFOClock::now() + timeout, std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait_until(FIFODeadline deadline, Args&&... args) {
+        return fifo.emplace_wait_until(deadline, std::forward<Args>(args)...);
+    }
+
+    /*
+     * Same as FIFOBuff_Timed.
+     */
+    bool remove(T *pitem, std::chrono::nanoseconds *psojourn = nullptr) {
+        hook_t  hook = { this, pitem, psojourn };
+
+        return fifo.remove(nullptr, hook);
+    }
+
+    /*
+     * Same as FIFOBuff_TS; blocks until an element is removed.  Dropped elements
+     * don't count.
+     *
+     * param psojourn: If not null, set to how long the removed element waited.
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and all of
+     *         its elements have been removed (or dropped).
+     */
+    FIFOStatus remove_wait(T *pitem, std::chrono::nanoseconds *psojourn = nullptr) {
+        return remove_wait_until(pitem, FIFODeadline::max(), psojourn);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if an element was removed, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and empty.
+     */
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline, std::chrono::nanoseconds *psojourn = nullptr) {
+        hook_t  hook = { this, pitem, psojourn };
+
+        return fifo.remove_wait_until(nullptr, deadline, hook);
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus remove_wait_for(T *pitem, const std::chrono::duration<Rep, Period> &timeout,
+                               std::chrono::nanoseconds *psojourn = nullptr) {
+        return remove_wait_until(pitem, FIFOClock::now() + timeout, psojourn);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     */
+    void close() {
+        fifo.close();
+    }
+
+    bool closed() const {
+        return fifo.closed();
+    }
+};
+
+#endif
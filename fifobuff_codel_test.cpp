@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <chrono>
+#include "gtest/gtest.h"
+#include "fifobuff_codel.hpp"
+
+#define CAP 10
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+/*
+ * Test that removes report how long each element waited, and that nothing is
+ * dropped without an AQM policy.
+ */
+TEST(FIFOBuffCoDelTest, sojourn) {
+    FIFOBuff_Timed<int> fb(CAP);
+    nanoseconds         sojourn;
+    int                 tmp;
+
+    ASSERT_FALSE(fb.remove(&tmp, &sojourn));
+    ASSERT_EQ(0, fb.head_sojourn().count());
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+
+    usleep(5000);
+    ASSERT_GE(fb.head_sojourn(), milliseconds(5));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp, &sojourn));
+        ASSERT_EQ(i, tmp);
+        ASSERT_GE(sojourn, milliseconds(5));
+    }
+
+    ASSERT_EQ(0u, fb.dropped());
+}
+
+/*
+ * Test the CoDel state machine with made-up times: a burst shorter than the
+ * interval is left alone; a standing queue is dropped from at an increasing
+ * rate, and dropping stops once the delay is back under target.
+ */
+TEST(FIFOBuffCoDelTest, control_law) {
+    FIFOCoDel       codel(milliseconds(5), milliseconds(100));
+    FIFODeadline    t0 = FIFOClock::now();
+    int             drops = 0;
+
+    // Above target, but not for a whole interval yet.
+    ASSERT_FALSE(codel.drop_head(t0, milliseconds(10), 5));
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(50), milliseconds(10), 5));
+
+    // Never the last element.
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(150), milliseconds(10), 0));
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(150), milliseconds(10), 5));
+
+    // Standing queue for an interval: first drop right away.
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(200), milliseconds(10), 5));
+    ASSERT_TRUE(codel.drop_head(t0 + milliseconds(260), milliseconds(10), 5));
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(260), milliseconds(10), 5));
+
+    // Next drops come interval/sqrt(count) apart: 100ms, then ~71ms, ~58ms...
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(350), milliseconds(10), 5));
+    ASSERT_TRUE(codel.drop_head(t0 + milliseconds(361), milliseconds(10), 5));
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(420), milliseconds(10), 5));
+    ASSERT_TRUE(codel.drop_head(t0 + milliseconds(432), milliseconds(10), 5));
+
+    for (int ms = 433; ms < 1433; ms++) {
+        drops += codel.drop_head(t0 + milliseconds(ms), milliseconds(10), 5);
+    }
+
+    // Rate keeps rising: more than the 10/s of a fixed interval.
+    ASSERT_GT(drops, 15);
+
+    // Delay under target ends the dropping state.
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(1500), milliseconds(1), 5));
+    ASSERT_FALSE(codel.drop_head(t0 + milliseconds(1600), milliseconds(10), 5));
+}
+
+/*
+ * Test that with the consumer slower than the producer, the queue (and the
+ * sojourn time) keeps growing without AQM, while CoDel drops at the head and
+ * keeps it down.
+ */
+TEST(FIFOBuffCoDelTest, overload) {
+    FIFOBuff_TimedTS<int, 1024, FIFOCoDel>  fb(FIFOCoDel(milliseconds(1), milliseconds(5)));
+    FIFOBuff_TimedTS<int, 1024>             fb_plain;
+    nanoseconds                             sojourn;
+    nanoseconds                             sojourn_plain;
+    int                                     tmp;
+
+    for (int i = 0; i < 400; i++) {
+        // Two in, one out.
+        fb.add(i);
+        fb.add(i);
+        fb_plain.add(i);
+        fb_plain.add(i);
+
+        usleep(500);
+
+        fb.remove_wait(&tmp, &sojourn);
+        fb_plain.remove_wait(&tmp, &sojourn_plain);
+    }
+
+    ASSERT_GT(fb.dropped(), 0u);
+    ASSERT_EQ(0u, fb_plain.dropped());
+    ASSERT_LT(sojourn * 2, sojourn_plain);
+}
+
+/*
+ * Test that once a burst has been dropped from and drained, a later burst that
+ * sits above target for less than an interval is left alone.
+ */
+TEST(FIFOBuffCoDelTest, idle) {
+    FIFOBuff_TimedTS<int, 1024, FIFOCoDel>  fb(FIFOCoDel(milliseconds(1), milliseconds(20)));
+    size_t                                  dropped;
+    int                                     removed = 0;
+    int                                     tmp;
+
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    usleep(2000);
+
+    // Drain slowly enough for the delay to stand above target.
+    while (fb.remove(&tmp)) {
+        usleep(500);
+    }
+
+    dropped = fb.dropped();
+    ASSERT_GT(dropped, 0u);
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    usleep(5000);
+
+    while (fb.remove(&tmp)) {
+        removed++;
+    }
+
+    ASSERT_EQ(200, removed);
+    ASSERT_EQ(dropped, fb.dropped());
+}
+
+/*
+ * Test that FIFOBuff_TS's policies, stats and eventfd carry over: the overflow
+ * policy sheds at the tail, CoDel drops at the head, and both count as evicted.
+ */
+TEST(FIFOBuffCoDelTest, policies) {
+    FIFOBuff_TimedTS<int, 0, FIFOCoDel, FIFOCombiner, FIFOStats, FIFODropOldest>
+                    fb(CAP, FIFOCoDel(milliseconds(1), milliseconds(5)));
+    int             fd = fb.enable_event_fd();
+    struct pollfd   pfd = { fd, POLLIN, 0 };
+    FIFOStatsData   st;
+    nanoseconds     sojourn;
+    int             removed = 0;
+    int             tmp;
+
+    ASSERT_GE(fd, 0);
+
+    for (int i = 0; i < 2*CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_EQ(1, poll(&pfd, 1, 0));
+    ASSERT_EQ((size_t)CAP, fb.overflow_dropped());
+
+    usleep(10000);
+
+    // The oldest survivor is CAP; drain slowly enough for CoDel to drop.
+    ASSERT_TRUE(fb.remove(&tmp, &sojourn));
+    ASSERT_EQ(CAP, tmp);
+    ASSERT_GE(sojourn, milliseconds(10));
+    removed++;
+
+    while (fb.remove(&tmp)) {
+        removed++;
+        usleep(1000);
+    }
+
+    st = fb.stats();
+    ASSERT_GT(fb.dropped(), 0u);
+    ASSERT_EQ((size_t)CAP, removed + fb.dropped());
+    ASSERT_EQ(2u*CAP, st.adds);
+    ASSERT_EQ((uint64_t)removed, st.removes);
+    ASSERT_EQ(CAP + fb.dropped(), st.evicted);
+}
+
+static FIFOBuff_TimedTS<int>    close_fifo(CAP);
+static int                      close_got;
+
+static void *close_consumer(void *) {
+    int     tmp;
+
+    while (close_fifo.remove_wait(&tmp) == FIFO_OK) {
+        close_got++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test timed waits, and that 'close()' releases a blocked consumer once the
+ * FIFO is drained.
+ */
+TEST(FIFOBuffCoDelTest, close) {
+    pthread_t   thread;
+    int         tmp;
+
+    ASSERT_EQ(FIFO_TIMEOUT, close_fifo.remove_wait_for(&tmp, milliseconds(5)));
+
+    while (close_fifo.add(13)) {
+    }
+
+    ASSERT_EQ(FIFO_TIMEOUT, close_fifo.add_wait_for(13, milliseconds(5)));
+
+    pthread_create(&thread, nullptr, close_consumer, nullptr);
+
+    ASSERT_EQ(FIFO_OK, close_fifo.add_wait(13));
+    close_fifo.close();
+    pthread_join(thread, nullptr);
+
+    ASSERT_TRUE(close_fifo.closed());
+    ASSERT_GT(close_got, CAP);
+    ASSERT_FALSE(close_fifo.add(13));
+    ASSERT_EQ(FIFO_CLOSED, close_fifo.add_wait(13));
+    ASSERT_EQ(FIFO_CLOSED, close_fifo.remove_wait(&tmp));
+}
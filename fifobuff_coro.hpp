@@ -0,0 +1,428 @@
+/*
+ * File: fifobuff_coro.hpp
+ *
+ * Provides a fixed-sized FIFO buffer whose add/remove can be awaited from C++20
+ * coroutines, plus a small thread pool executor to resume them on.
+ *
+ */
+#ifndef __FIFOBUFF_CORO_HPP__
+#define __FIFOBUFF_CORO_HPP__
+
+#if __cplusplus < 202002L
+#error "fifobuff_coro.hpp requires C++20"
+#endif
+
+#include <pthread.h>
+#include <coroutine>
+#include <optional>
+#include <vector>
+#include "fifobuff.hpp"
+
+/*
+ * Coroutine FIFO Buffer Class
+ *
+ * Thread-safe like FIFOBuff_TS, but instead of blocking a thread, 'async_add()'
+ * and 'async_remove()' return awaitables that suspend the calling coroutine until
+ * there's room or data.  Suspended coroutines are kept in FIFO order in intrusive
+ * wait lists (the list nodes live in the awaitables, so waiting allocates
+ * nothing), and the element is handed directly to/from the waiter that is woken.
+ * The waiter is then resumed on the executor it supplied, never on the thread
+ * that made the room or data available.
+ *
+ * An executor is anything with a 'post(std::coroutine_handle<>)' member that
+ * resumes the handle later on some thread (e.g. FIFOThreadPool below).  It must
+ * outlive any coroutine suspended on it.
+ *
+ * 'add()'/'remove()' are the non-blocking versions for plain threads; they wake
+ * suspended coroutines just the same.  'close()' resumes all waiters: adds then
+ * fail with FIFO_CLOSED and removes return the remaining elements, then an empty
+ * std::optional (end-of-stream).
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_Coro {
+    struct waiter_t {
+        waiter_t                *next;
+        std::coroutine_handle<> handle;
+        void                    *exec;
+        void                    (*post)(void *exec, std::coroutine_handle<> handle);
+        FIFOStatus              status;
+    };
+
+    struct add_waiter_t : waiter_t {
+        T                   item;
+
+        template <typename U>
+        add_waiter_t(U &&item) : item(std::forward<U>(item)) {}
+    };
+
+    struct rem_waiter_t : waiter_t {
+        std::optional<T>    item;
+    };
+
+    struct waitq_t {
+        waiter_t    *head = nullptr;
+        waiter_t    *tail = nullptr;
+
+        void push(waiter_t *w) {
+            w->next = nullptr;
+
+            if (tail != nullptr) {
+                tail->next = w;
+            }
+            else {
+                head = w;
+            }
+
+            tail = w;
+        }
+
+        waiter_t *pop() {
+            waiter_t    *w = head;
+
+            if (w != nullptr) {
+                head = w->next;
+
+                if (head == nullptr) {
+                    tail = nullptr;
+                }
+            }
+
+            return w;
+        }
+    };
+
+    FIFOBuff<T, N>      fifo;
+    pthread_mutex_t     mutex;
+    waitq_t             add_q;
+    waitq_t             rem_q;
+    bool                is_closed = false;
+
+    template <typename Executor>
+    static void post_to(void *exec, std::coroutine_handle<> handle) {
+        static_cast<Executor*>(exec)->post(handle);
+    }
+
+    template <typename Executor>
+    static void bind(waiter_t *w, Executor &exec, std::coroutine_handle<> handle) {
+        w->handle = handle;
+        w->exec = &exec;
+        w->post = &post_to<Executor>;
+    }
+
+    /*
+     * Hands the waiter back to its executor.  The waiter (and its coroutine) may
+     * be gone as soon as this is called.
+     */
+    static void resume(waiter_t *w) {
+        w->post(w->exec, w->handle);
+    }
+
+    /*
+     * Adds an element, or hands it straight to a suspended remover.  Called with
+     * the mutex held.
+     *
+     * param pw: Set to the remover to resume (after unlocking) or null.
+     * return: Returns FIFO_TIMEOUT if there's no room.
+     */
+    template <typename U>
+    FIFOStatus put_locked(U &&item, waiter_t **pw) {
+        *pw = nullptr;
+
+        if (is_closed) {
+            return FIFO_CLOSED;
+        }
+
+        if (rem_q.head != nullptr) {
+            rem_waiter_t    *w = static_cast<rem_waiter_t*>(rem_q.pop());
+
+            w->item.emplace(std::forward<U>(item));
+            w->status = FIFO_OK;
+            *pw = w;
+        }
+        else if (!fifo.emplace(std::forward<U>(item))) {
+            return FIFO_TIMEOUT;
+        }
+
+        return FIFO_OK;
+    }
+
+    /*
+     * Removes the front element and refills its slot from a suspended adder.
+     * Called with the mutex held.
+     *
+     * param pw: Set to the adder to resume (after unlocking) or null.
+     * return: Returns FIFO_TIMEOUT if the FIFO is empty.
+     */
+    FIFOStatus take_locked(std::optional<T> &item, waiter_t **pw) {
+        *pw = nullptr;
+
+        if (fifo.size() == 0) {
+            return is_closed ? FIFO_CLOSED : FIFO_TIMEOUT;
+        }
+
+        item.emplace(std::move(*fifo.data().first.ptr));
+        fifo.remove(nullptr);
+
+        if (add_q.head != nullptr) {
+            add_waiter_t    *w = static_cast<add_waiter_t*>(add_q.pop());
+
+            fifo.emplace(std::move(w->item));
+            w->status = FIFO_OK;
+            *pw = w;
+        }
+
+        return FIFO_OK;
+    }
+
+public:
+    /*
+     * Awaitable returned by 'async_add()'.  Resumes with FIFO_OK or FIFO_CLOSED.
+     */
+    template <typename Executor>
+    class add_awaiter_t : add_waiter_t {
+        FIFOBuff_Coro   &fb;
+        Executor        &exec;
+
+    public:
+        template <typename U>
+        add_awaiter_t(FIFOBuff_Coro &fb, Executor &exec, U &&item) :
+            add_waiter_t(std::forward<U>(item)), fb(fb), exec(exec) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter_t    *w;
+
+            pthread_mutex_lock(&fb.mutex);
+            this->status = fb.put_locked(std::move(this->item), &w);
+
+            if (this->status == FIFO_TIMEOUT) {
+                bind(this, exec, handle);
+                fb.add_q.push(this);
+                pthread_mutex_unlock(&fb.mutex);
+
+                return true;
+            }
+
+            pthread_mutex_unlock(&fb.mutex);
+
+            if (w != nullptr) {
+                resume(w);
+            }
+
+            return false;
+        }
+
+        FIFOStatus await_resume() const noexcept {
+            return this->status;
+        }
+    };
+
+    /*
+     * Awaitable returned by 'async_remove()'.  Resumes with the element, or an
+     * empty std::optional once the FIFO is closed and drained.
+     */
+    template <typename Executor>
+    class rem_awaiter_t : rem_waiter_t {
+        FIFOBuff_Coro   &fb;
+        Executor        &exec;
+
+    public:
+        rem_awaiter_t(FIFOBuff_Coro &fb, Executor &exec) : fb(fb), exec(exec) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter_t    *w;
+
+            pthread_mutex_lock(&fb.mutex);
+            this->status = fb.take_locked(this->item, &w);
+
+            if (this->status == FIFO_TIMEOUT) {
+                bind(this, exec, handle);
+                fb.rem_q.push(this);
+                pthread_mutex_unlock(&fb.mutex);
+
+                return true;
+            }
+
+            pthread_mutex_unlock(&fb.mutex);
+
+            if (w != nullptr) {
+                resume(w);
+            }
+
+            return false;
+        }
+
+        std::optional<T> await_resume() {
+            return std::move(this->item);
+        }
+    };
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_Coro() {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+
+    FIFOBuff_Coro(size_t cap) : fifo(cap) {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+
+    ~FIFOBuff_Coro() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    size_t capacity() const {
+        return fifo.capacity();
+    }
+
+    /*
+     * Adds an element without blocking.  If a coroutine is waiting in
+     * 'async_remove()', the element is handed to it.
+     *
+     * return: Returns false if the FIFO is full or closed.
+     */
+    template <typename U>
+    bool add(U &&item) {
+        waiter_t    *w;
+        FIFOStatus  status;
+
+        pthread_mutex_lock(&mutex);
+        status = put_locked(std::forward<U>(item), &w);
+        pthread_mutex_unlock(&mutex);
+
+        if (w != nullptr) {
+            resume(w);
+        }
+
+        return status == FIFO_OK;
+    }
+
+    /*
+     * Removes an element without blocking.  If a coroutine is waiting in
+     * 'async_add()', its element takes the freed slot.
+     *
+     * return: Returns false if the FIFO is empty.
+     */
+    bool remove(T *pitem) {
+        std::optional<T>    item;
+        waiter_t            *w;
+        FIFOStatus          status;
+
+        pthread_mutex_lock(&mutex);
+        status = take_locked(item, &w);
+        pthread_mutex_unlock(&mutex);
+
+        if (w != nullptr) {
+            resume(w);
+        }
+
+        if (status != FIFO_OK) {
+            return false;
+        }
+
+        if (pitem != nullptr) {
+            *pitem = std::move(*item);
+        }
+
+        return true;
+    }
+
+    /*
+     * Returns an awaitable that adds 'item', suspending the coroutine on 'exec'
+     * while the FIFO is full.
+     *
+     * usage: FIFOStatus st = co_await fb.async_add(item, exec);
+     */
+    template <typename U, typename Executor>
+    add_awaiter_t<Executor> async_add(U &&item, Executor &exec) {
+        return add_awaiter_t<Executor>(*this, exec, std::forward<U>(item));
+    }
+
+    /*
+     * Returns an awaitable that removes the front element, suspending the
+     * coroutine on 'exec' while the FIFO is empty.
+     *
+     * usage: std::optional<T> item = co_await fb.async_remove(exec);
+     */
+    template <typename Executor>
+    rem_awaiter_t<Executor> async_remove(Executor &exec) {
+        return rem_awaiter_t<Executor>(*this, exec);
+    }
+
+    /*
+     * Closes the FIFO and resumes every suspended coroutine.
+     */
+    void close() {
+        waitq_t     woken;
+        waiter_t    *w;
+
+        pthread_mutex_lock(&mutex);
+        is_closed = true;
+
+        while ((w = add_q.pop()) != nullptr || (w = rem_q.pop()) != nullptr) {
+            w->status = FIFO_CLOSED;
+            woken.push(w);
+        }
+
+        pthread_mutex_unlock(&mutex);
+
+        while ((w = woken.pop()) != nullptr) {
+            resume(w);
+        }
+    }
+};
+
+/*
+ * Thread Pool Executor
+ *
+ * Minimal executor for FIFOBuff_Coro: 'post()' queues a coroutine handle in a
+ * FIFOBuff_TS and one of 'nthreads' workers resumes it.  'cap' must cover the
+ * most coroutines that can be runnable at once, since a full queue blocks the
+ * poster (which may be a worker).  The destructor runs what's queued, then joins
+ * the workers.
+ */
+class FIFOThreadPool {
+    FIFOBuff_TS<std::coroutine_handle<>>    runq;
+    std::vector<pthread_t>                  threads;
+
+    static void *worker(void *arg) {
+        FIFOThreadPool          *pool = static_cast<FIFOThreadPool*>(arg);
+        std::coroutine_handle<> handle;
+
+        while (pool->runq.remove_wait(&handle) == FIFO_OK) {
+            handle.resume();
+        }
+
+        return nullptr;
+    }
+
+public:
+    FIFOThreadPool(size_t nthreads, size_t cap) : runq(cap), threads(nthreads) {
+        for (size_t i = 0; i < nthreads; i++) {
+            pthread_create(&threads[i], nullptr, worker, this);
+        }
+    }
+
+    ~FIFOThreadPool() {
+        runq.close();
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], nullptr);
+        }
+    }
+
+    void post(std::coroutine_handle<> handle) {
+        runq.add_wait(handle);
+    }
+};
+
+#endif
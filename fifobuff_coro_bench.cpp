@@ -0,0 +1,113 @@
+/*
+ * File: fifobuff_coro_bench.cpp
+ *
+ * Benchmarks for FIFOBuff_Coro in fifobuff_coro.hpp.  Needs C++20 and Google
+ * Benchmark (see CMakeLists.txt).
+ */
+#include <sched.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include "benchmark/benchmark.h"
+#include "fifobuff_coro.hpp"
+
+#define BENCH_CAP       1024
+#define POOL_THREADS    4
+
+struct detached {
+    struct promise_type {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static detached consumer(FIFOBuff_Coro<int> &fb, FIFOThreadPool &pool, std::atomic<int> &finished) {
+    std::optional<int>  item;
+
+    while ((item = co_await fb.async_remove(pool))) {
+        benchmark::DoNotOptimize(*item);
+    }
+
+    finished++;
+}
+
+/*
+ * 'range(0)' consumer coroutines, all suspended in 'async_remove()' when idle,
+ * multiplexed on a pool of POOL_THREADS threads and fed by the benchmark thread.
+ * The same number of consumers blocking in FIFOBuff_TS::remove_wait() would each
+ * need a thread of their own.
+ */
+static void BM_Coro_Consumers(benchmark::State &state) {
+    int                 consumers = state.range(0);
+    FIFOBuff_Coro<int>  fb(BENCH_CAP);
+    FIFOThreadPool      pool(POOL_THREADS, consumers + BENCH_CAP);
+    std::atomic<int>    finished(0);
+    int                 i = 0;
+
+    for (int c = 0; c < consumers; c++) {
+        consumer(fb, pool, finished);
+    }
+
+    for (auto _ : state) {
+        while (!fb.add(i)) {
+            sched_yield();
+        }
+
+        i++;
+    }
+
+    fb.close();
+
+    while (finished.load() < consumers) {
+        sched_yield();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Coro_Consumers)->Arg(1)->Arg(100)->Arg(10000)->UseRealTime();
+
+static detached producer(FIFOBuff_Coro<int> &fb, FIFOThreadPool &pool, std::atomic<int> &finished) {
+    int     i = 0;
+
+    while (co_await fb.async_add(i++, pool) == FIFO_OK);
+
+    finished++;
+}
+
+/*
+ * The reverse: 'range(0)' producer coroutines suspended in 'async_add()' on a full
+ * FIFO, drained by the benchmark thread.
+ */
+static void BM_Coro_Producers(benchmark::State &state) {
+    int                 producers = state.range(0);
+    FIFOBuff_Coro<int>  fb(BENCH_CAP);
+    FIFOThreadPool      pool(POOL_THREADS, producers + BENCH_CAP);
+    std::atomic<int>    finished(0);
+    int                 tmp;
+
+    for (int p = 0; p < producers; p++) {
+        producer(fb, pool, finished);
+    }
+
+    for (auto _ : state) {
+        while (!fb.remove(&tmp)) {
+            sched_yield();
+        }
+
+        benchmark::DoNotOptimize(tmp);
+    }
+
+    fb.close();
+
+    while (finished.load() < producers) {
+        sched_yield();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Coro_Producers)->Arg(1)->Arg(100)->Arg(10000)->UseRealTime();
+
+BENCHMARK_MAIN();
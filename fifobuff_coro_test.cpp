@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <vector>
+#include "gtest/gtest.h"
+#include "fifobuff_coro.hpp"
+
+#define CAP 10
+
+/*
+ * Fire-and-forget coroutine type: runs until its first suspension when called
+ * and frees itself when it finishes.
+ */
+struct detached {
+    struct promise_type {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+/*
+ * Executor that only queues handles; the test resumes them with 'run()'.
+ */
+struct manual_exec {
+    std::vector<std::coroutine_handle<>>    handles;
+
+    void post(std::coroutine_handle<> handle) {
+        handles.push_back(handle);
+    }
+
+    size_t run() {
+        std::vector<std::coroutine_handle<>>    ready;
+
+        ready.swap(handles);
+
+        for (size_t i = 0; i < ready.size(); i++) {
+            ready[i].resume();
+        }
+
+        return ready.size();
+    }
+};
+
+static detached consume(FIFOBuff_Coro<int> &fb, manual_exec &exec, std::vector<int> &got) {
+    for (;;) {
+        std::optional<int>  item = co_await fb.async_remove(exec);
+
+        if (!item) {
+            break;
+        }
+
+        got.push_back(*item);
+    }
+
+    got.push_back(-1);
+}
+
+static detached produce(FIFOBuff_Coro<int> &fb, manual_exec &exec, int first, int cnt, int *done) {
+    for (int i = first; i < first + cnt; i++) {
+        if (co_await fb.async_add(i, exec) != FIFO_OK) {
+            break;
+        }
+    }
+
+    *done = 1;
+}
+
+/*
+ * Test the non-blocking add/remove from a single thread.
+ */
+TEST(FIFOBuffCoroTest, add_remove) {
+    FIFOBuff_Coro<int>  fb(CAP);
+    int                 tmp;
+
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+/*
+ * Test that a consumer suspends on an empty FIFO and is resumed on its executor
+ * (not inline in 'add()') with the element that was added.
+ */
+TEST(FIFOBuffCoroTest, async_remove) {
+    FIFOBuff_Coro<int>  fb(CAP);
+    manual_exec         exec;
+    std::vector<int>    got;
+
+    consume(fb, exec, got);
+    ASSERT_TRUE(got.empty());
+
+    ASSERT_TRUE(fb.add(1));
+    ASSERT_TRUE(got.empty());
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(std::vector<int>({1}), got);
+
+    // Elements already in the FIFO are taken without suspending.
+    ASSERT_TRUE(fb.add(2));
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_TRUE(fb.add(3));
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(std::vector<int>({1, 2, 3}), got);
+
+    fb.close();
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(std::vector<int>({1, 2, 3, -1}), got);
+}
+
+/*
+ * Test that a producer suspends on a full FIFO and that its element takes the
+ * slot freed by a remove, in order.
+ */
+TEST(FIFOBuffCoroTest, async_add) {
+    FIFOBuff_Coro<int>  fb(CAP);
+    manual_exec         exec;
+    int                 done = 0;
+    int                 tmp;
+
+    produce(fb, exec, 0, CAP + 2, &done);
+    ASSERT_EQ(0, done);
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(0, tmp);
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(0, done);
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(1, tmp);
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(1, done);
+
+    for (int i = 2; i < CAP + 2; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+/*
+ * Test that 'close()' resumes suspended producers with FIFO_CLOSED.
+ */
+TEST(FIFOBuffCoroTest, close) {
+    FIFOBuff_Coro<int>  fb(CAP);
+    manual_exec         exec;
+    int                 done = 0;
+    int                 tmp;
+
+    produce(fb, exec, 0, CAP + 5, &done);
+    ASSERT_EQ(0, done);
+
+    fb.close();
+    ASSERT_EQ(1u, exec.run());
+    ASSERT_EQ(1, done);
+    ASSERT_FALSE(fb.add(13));
+
+    // Elements added before the close can still be removed.
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+#define PRODUCTS        100000
+#define CONSUMERS       1000
+#define POOL_THREADS    4
+
+static std::atomic<int>     check[PRODUCTS];
+static std::atomic<int>     finished;
+
+static detached pool_consumer(FIFOBuff_Coro<int> &fb, FIFOThreadPool &pool) {
+    std::optional<int>  item;
+
+    while ((item = co_await fb.async_remove(pool))) {
+        check[*item]++;
+    }
+
+    finished++;
+}
+
+/*
+ * Test many suspended consumers on a small thread pool fed by a plain thread.
+ */
+TEST(FIFOBuffCoroTest, threaded) {
+    FIFOBuff_Coro<int>  fb(CAP);
+    FIFOThreadPool      pool(POOL_THREADS, CONSUMERS);
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        check[i] = 0;
+    }
+
+    finished = 0;
+
+    for (int c = 0; c < CONSUMERS; c++) {
+        pool_consumer(fb, pool);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        while (!fb.add(i)) {
+            sched_yield();
+        }
+    }
+
+    fb.close();
+
+    while (finished.load() < CONSUMERS) {
+        sched_yield();
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i].load());
+    }
+}
@@ -0,0 +1,242 @@
+/*
+ * File: fifobuff_latency.cpp
+ *
+ * End-to-end handoff latency harness for FIFOBuff_TS.  Producers add elements
+ * stamped with the time they were meant to be sent, at a fixed rate (open loop),
+ * and consumers record how long after that they removed them in a log-linear
+ * histogram.  Because the stamp is the intended send time rather than the time
+ * 'add_wait()' was called, a producer held up by a full FIFO (or a stalled
+ * consumer) doesn't hide the elements it should have sent meanwhile: their wait
+ * is counted ("coordinated omission").
+ *
+ * Prints p50/p99/p99.9/max for each producer/consumer configuration and wait
+ * policy.
+ *
+ * usage: fifobuff_latency [-r rate per producer, per second] [-n elements per producer]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "fifobuff.hpp"
+
+#define LAT_CAP         1024
+#define LAT_RATE        100000
+#define LAT_CNT         100000
+
+/*
+ * Log-linear histogram (as in HdrHistogram): values below 2^(SUB_BITS+1) get a
+ * bucket each; above that, each power of two is split into 2^SUB_BITS buckets,
+ * so a value is recorded with a relative error under 2^-SUB_BITS (about 3%).
+ * Recording is an index computation and an increment.
+ */
+class LatencyHist {
+    static const int    SUB_BITS = 5;
+    static const int    BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    std::vector<uint64_t>   counts;
+    uint64_t                total;
+    uint64_t                max_val;
+
+    static int msb(uint64_t v) {
+        return 63 - __builtin_clzll(v | 1);
+    }
+
+    static size_t index(uint64_t v) {
+        int     e = std::max(0, msb(v) - SUB_BITS);
+
+        return ((size_t)e << SUB_BITS) + (v >> e);
+    }
+
+    /*
+     * Largest value that maps to bucket 'idx'.
+     */
+    static uint64_t bucket_high(size_t idx) {
+        int     e = idx < (2u << SUB_BITS) ? 0 : (int)(idx >> SUB_BITS) - 1;
+
+        return (((idx - ((size_t)e << SUB_BITS)) + 1) << e) - 1;
+    }
+
+public:
+    LatencyHist() : counts(BUCKETS, 0), total(0), max_val(0) {}
+
+    void record(uint64_t v) {
+        counts[index(v)]++;
+        total++;
+        max_val = std::max(max_val, v);
+    }
+
+    void merge(const LatencyHist &other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+
+        total += other.total;
+        max_val = std::max(max_val, other.max_val);
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return max_val;
+    }
+
+    /*
+     * Returns the value at quantile 'q' (0 to 1), rounded up to its bucket.
+     */
+    uint64_t percentile(double q) const {
+        uint64_t    want = (uint64_t)(q * total + 0.5);
+        uint64_t    seen = 0;
+
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+
+            if (seen >= want && seen > 0) {
+                return std::min(bucket_high(i), max_val);
+            }
+        }
+
+        return max_val;
+    }
+};
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Waits until 'when' (steady clock ns).  Sleeps while it's far off and yields
+ * the last stretch, so sending isn't late by a scheduler tick but consumers can
+ * still run when there are more threads than CPUs.
+ */
+static void wait_until(uint64_t when) {
+    uint64_t    now = now_ns();
+
+    if (when > now + 100000) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(when - now - 50000));
+    }
+
+    while (now_ns() < when) {
+        sched_yield();
+    }
+}
+
+struct lat_policy {
+    const char      *name;
+    FIFOWaitPolicy  policy;
+};
+
+/*
+ * Runs one configuration and returns the merged consumer histogram.
+ */
+static LatencyHist run(int nprod, int ncons, const FIFOWaitPolicy &policy, uint64_t rate, int cnt) {
+    FIFOBuff_TS<uint64_t, LAT_CAP>  fb;
+    std::vector<LatencyHist>        hists(ncons);
+    std::vector<std::thread>        threads;
+    uint64_t                        interval = 1000000000ull / rate;
+    uint64_t                        start;
+    LatencyHist                     all;
+
+    fb.set_wait_policy(policy);
+
+    for (int c = 0; c < ncons; c++) {
+        threads.emplace_back([&fb, &hists, c]() {
+            uint64_t    stamp = 0;
+
+            // A zero stamp tells the consumer to stop.
+            while (fb.remove_wait(&stamp) == FIFO_OK && stamp != 0) {
+                uint64_t    now = now_ns();
+
+                hists[c].record(now > stamp ? now - stamp : 0);
+            }
+        });
+    }
+
+    // Producers start together, staggered within one interval.
+    start = now_ns() + 1000000;
+
+    for (int p = 0; p < nprod; p++) {
+        threads.emplace_back([&fb, start, interval, nprod, p, cnt]() {
+            uint64_t    when = start + interval * p / nprod;
+
+            for (int i = 0; i < cnt; i++, when += interval) {
+                wait_until(when);
+                fb.add_wait(when);
+            }
+        });
+    }
+
+    for (int p = 0; p < nprod; p++) {
+        threads[ncons + p].join();
+    }
+
+    for (int c = 0; c < ncons; c++) {
+        fb.add_wait(0);
+    }
+
+    for (int c = 0; c < ncons; c++) {
+        threads[c].join();
+        all.merge(hists[c]);
+    }
+
+    return all;
+}
+
+int main(int argc, char **argv) {
+    static const int    configs[][2] = {{1, 1}, {1, 4}, {4, 1}, {4, 4}};
+    static lat_policy   policies[] = {
+        {"park",        FIFOWaitPolicy()},
+        {"yield",       FIFOWaitPolicy(0, 16)},
+        {"spin",        FIFOWaitPolicy(4000, 4)},
+        {"adaptive",    FIFOWaitPolicy(4000, 4, true)},
+    };
+    uint64_t            rate = LAT_RATE;
+    int                 cnt = LAT_CNT;
+    int                 opt;
+
+    while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate = strtoull(optarg, nullptr, 0);
+            break;
+        case 'n':
+            cnt = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate per producer] [-n elements per producer]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (rate == 0 || cnt <= 0) {
+        fprintf(stderr, "rate and count must be positive\n");
+        return 1;
+    }
+
+    printf("%llu elements/s and %d elements per producer; latencies in ns\n\n", (unsigned long long)rate, cnt);
+    printf("%-5s %-5s %-10s %10s %10s %10s %10s %12s\n", "prod", "cons", "policy", "count", "p50", "p99", "p99.9", "max");
+
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+            LatencyHist h = run(configs[c][0], configs[c][1], policies[p].policy, rate, cnt);
+
+            printf("%-5d %-5d %-10s %10llu %10llu %10llu %10llu %12llu\n",
+                   configs[c][0], configs[c][1], policies[p].name,
+                   (unsigned long long)h.count(),
+                   (unsigned long long)h.percentile(0.5),
+                   (unsigned long long)h.percentile(0.99),
+                   (unsigned long long)h.percentile(0.999),
+                   (unsigned long long)h.max());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * File: fifobuff_mpmc.hpp
+ *
+ * Provides a lock-free, fixed-sized FIFO buffer for any number of producer and
+ * consumer threads.
+ *
+ */
+#ifndef __FIFOBUFF_MPMC_HPP__
+#define __FIFOBUFF_MPMC_HPP__
+
+#include <assert.h>
+#include <sched.h>
+#include <atomic>
+#include <chrono>
+#include "fifobuff.hpp"
+
+/*
+ * Default wait policy of FIFOBuff_MPMC: a short spin and a few yields before
+ * parking, since a lock-free handoff is usually over sooner than a futex call.
+ */
+#ifndef FIFOBUFF_MPMC_SPIN
+#define FIFOBUFF_MPMC_SPIN      64
+#endif
+
+#ifndef FIFOBUFF_MPMC_YIELDS
+#define FIFOBUFF_MPMC_YIELDS    64
+#endif
+
+/*
+ * Multi-Producer/Multi-Consumer FIFO Buffer Class
+ *
+ * A bounded lock-free alternative to FIFOBuff_TS based on Dmitry Vyukov's MPMC
+ * queue.  Every slot carries a sequence number that says whether it is ready to
+ * be written or read for a given lap around the buffer, so producers and consumers
+ * only contend on their own position counter (one CAS per operation) and never on
+ * a lock.  Keeps the 'add()'/'remove()' (try) and 'add_wait()'/'remove_wait()'
+ * (blocking) semantics of FIFOBuff_TS, including 'close()' and timed waits.
+ * Blocked threads spin and yield as the FIFOWaitPolicy says, then park on a
+ * futex (see FIFOEventCount); an add or remove only enters the kernel when a
+ * thread is parked.  There is no 'peek()' since the front element may be
+ * removed by another consumer while it is being copied.
+ *
+ * The algorithm needs at least two slots.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (a power of two, at
+ *          least 2).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_MPMC : private FIFOCap<N> {
+    static_assert(N == 0 || N >= 2, "FIFOBuff_MPMC needs a capacity of at least 2");
+
+    typedef uint8_t item_mem_t[sizeof(T)];
+
+    // Set in 'enq_pos' by 'close()', so no add can claim a position after it.
+    static const size_t CLOSED_BIT = ~(~(size_t)0 >> 1);
+
+    struct cell_t {
+        std::atomic<size_t> seq;
+        item_mem_t          item;
+    };
+
+    cell_t                  *cells;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     enq_pos;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     deq_pos;
+
+    FIFOEventCount          room;       // Parks blocked adds.
+    FIFOEventCount          items;      // Parks blocked removes.
+
+    void init() {
+        assert(this->cap() >= 2);
+
+        room.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_MPMC_SPIN, FIFOBUFF_MPMC_YIELDS));
+        items.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_MPMC_SPIN, FIFOBUFF_MPMC_YIELDS));
+
+        cells = new cell_t[this->cap()];
+
+        for (size_t i = 0; i < this->cap(); i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        enq_pos.store(0, std::memory_order_relaxed);
+        deq_pos.store(0, std::memory_order_relaxed);
+    }
+
+    /*
+     * Claims the next cell to write.
+     *
+     * param pos: Set to the claimed position.
+     * return: Returns the cell, or null if FIFO is full or closed.
+     */
+    cell_t *claim_add(size_t &pos) {
+        pos = enq_pos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            if (pos & CLOSED_BIT) {
+                return nullptr;
+            }
+
+            cell_t      *cell = &cells[this->wrap(pos)];
+            size_t      seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t    dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0) {
+                if (enq_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return cell;
+                }
+            }
+            else if (dif < 0) {
+                return nullptr;
+            }
+            else {
+                pos = enq_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+     * Claims the next cell to read.
+     *
+     * param pos: Set to the claimed position.
+     * return: Returns the cell, or null if FIFO is empty.
+     */
+    cell_t *claim_remove(size_t &pos) {
+        pos = deq_pos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            cell_t      *cell = &cells[this->wrap(pos)];
+            size_t      seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t    dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (dif == 0) {
+                if (deq_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return cell;
+                }
+            }
+            else if (dif < 0) {
+                return nullptr;
+            }
+            else {
+                pos = deq_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+     * Returns true if 'claim_add()' may succeed (or the FIFO is closed).
+     */
+    bool add_ready() const {
+        size_t  pos = enq_pos.load(std::memory_order_relaxed);
+
+        return (pos & CLOSED_BIT) ||
+                (intptr_t)(cells[this->wrap(pos)].seq.load(std::memory_order_acquire) - pos) >= 0;
+    }
+
+    /*
+     * Returns true if 'claim_remove()' may succeed (or the FIFO is closed).
+     */
+    bool remove_ready() const {
+        size_t  pos = deq_pos.load(std::memory_order_relaxed);
+
+        return closed() ||
+                (intptr_t)(cells[this->wrap(pos)].seq.load(std::memory_order_acquire) - (pos + 1)) >= 0;
+    }
+
+    /*
+     * Called when a consumer found nothing to take from a closed FIFO.  An add
+     * may have claimed a position before 'close()' but not filled it yet, so the
+     * stream has only ended once every claimed position has been removed.
+     *
+     * return: Returns true if no elements remain.
+     */
+    bool drained() const {
+        if ((enq_pos.load(std::memory_order_acquire) & ~CLOSED_BIT) == deq_pos.load(std::memory_order_acquire)) {
+            return true;
+        }
+
+        sched_yield();
+
+        return false;
+    }
+
+    static bool expired(FIFODeadline deadline) {
+        return deadline != FIFODeadline::max() && FIFOClock::now() >= deadline;
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_MPMC() : FIFOCap<N>(N) {
+        init();
+    }
+
+    /*
+     * Construct a FIFO buffer that can contain a max of 'max_cap' elements.  The
+     * buffer is always allocated since each slot also holds a sequence number.
+     */
+    FIFOBuff_MPMC(size_t max_cap) : FIFOCap<N>(max_cap) {
+        init();
+    }
+
+    ~FIFOBuff_MPMC() {
+        while (remove(nullptr)) {
+        }
+
+        delete [] cells;
+    }
+
+    /*
+     * Returns max number of elements FIFO can hold.
+     */
+    size_t capacity() const {
+        return this->cap();
+    }
+
+    /*
+     * Same as FIFOBuff_TS.  Call before the FIFO is shared between threads.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        room.set_wait_policy(policy);
+        items.set_wait_policy(policy);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     */
+    bool add(const T &item) {
+        return emplace(item);
+    }
+
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        size_t  pos;
+        cell_t  *cell = claim_add(pos);
+
+        if (cell == nullptr) {
+            return false;
+        }
+
+        put(cell, pos, std::forward<Args>(args)...);
+
+        return true;
+    }
+
+    /*
+     * Same as FIFOBuff_TS; blocks until room becomes available to add the item.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait(const T &item) {
+        return emplace_wait_until(FIFODeadline::max(), item);
+    }
+
+    FIFOStatus add_wait(T &&item) {
+        return emplace_wait_until(FIFODeadline::max(), std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait(Args&&... args) {
+        return emplace_wait_until(FIFODeadline::max(), std::forward<Args>(args)...);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if the element was added, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait_until(const T &item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, item);
+    }
+
+    FIFOStatus add_wait_until(T &&item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, std::move(item));
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(const T &item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, item);
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(T &&item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait_until(FIFODeadline deadline, Args&&... args) {
+        size_t      pos;
+        cell_t      *cell;
+        unsigned    step = 0;
+
+        while ((cell = claim_add(pos)) == nullptr) {
+            if (closed()) {
+                return FIFO_CLOSED;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            room.await(step, [this]() { return add_ready(); }, deadline);
+        }
+
+        put(cell, pos, std::forward<Args>(args)...);
+
+        return FIFO_OK;
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     */
+    bool remove(T *pitem) {
+        size_t  pos;
+        cell_t  *cell = claim_remove(pos);
+
+        if (cell == nullptr) {
+            return false;
+        }
+
+        take(cell, pos, pitem);
+
+        return true;
+    }
+
+    /*
+     * Same as FIFOBuff_TS; blocks until an element becomes available.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and all of
+     *         its elements have been removed.
+     */
+    FIFOStatus remove_wait(T *pitem) {
+        return remove_wait_until(pitem, FIFODeadline::max());
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if an element was removed, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and empty.
+     */
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline) {
+        size_t      pos;
+        cell_t      *cell;
+        unsigned    step = 0;
+
+        while ((cell = claim_remove(pos)) == nullptr) {
+            if (closed()) {
+                if (drained()) {
+                    return FIFO_CLOSED;
+                }
+
+                continue;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            items.await(step, [this]() { return remove_ready(); }, deadline);
+        }
+
+        take(cell, pos, pitem);
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus remove_wait_for(T *pitem, const std::chrono::duration<Rep, Period> &timeout) {
+        return remove_wait_until(pitem, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Same as FIFOBuff_TS: wakes all blocked threads; adds fail from then on,
+     * removes drain the remaining elements and then report FIFO_CLOSED.
+     */
+    void close() {
+        enq_pos.fetch_or(CLOSED_BIT, std::memory_order_acq_rel);
+        room.notify_all();
+        items.notify_all();
+    }
+
+    /*
+     * Returns true if 'close()' has been called.
+     */
+    bool closed() const {
+        return (enq_pos.load(std::memory_order_acquire) & CLOSED_BIT) != 0;
+    }
+
+private:
+
+    /*
+     * Constructs the element in a claimed cell and marks it readable.
+     */
+    template <typename... Args>
+    void put(cell_t *cell, size_t pos, Args&&... args) {
+        new (cell->item) T(std::forward<Args>(args)...);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        items.notify();
+    }
+
+    /*
+     * Moves the element out of a claimed cell and marks it writable for the next
+     * lap around the buffer.
+     */
+    void take(cell_t *cell, size_t pos, T *pitem) {
+        T   *p = reinterpret_cast<T*>(cell->item);
+
+        if (pitem != nullptr) {
+            *pitem = std::move(*p);
+        }
+
+        p->~T();
+        cell->seq.store(pos + this->cap(), std::memory_order_release);
+        room.notify();
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <memory>
+#include "gtest/gtest.h"
+#include "fifobuff_mpmc.hpp"
+
+#define CAP 10
+
+/*
+ * Test add/remove, including wrap-around, from a single thread.
+ */
+TEST(FIFOBuffMPMCTest, add_remove) {
+    FIFOBuff_MPMC<int>  fb(CAP);
+    int                 tmp;
+
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+
+    for (int i = 0; i < CAP/2; i++) {
+        fb.remove(nullptr);
+    }
+
+    for (int i = 0; i < CAP/2; i++) {
+        ASSERT_TRUE(fb.add(CAP + i));
+    }
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i+CAP/2, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+/*
+ * Test that a capacity of 1 is rejected: with a single slot, the sequence number
+ * an add leaves behind reads as "writable" for the next position, so a second
+ * 'add()' would succeed and overwrite the element nobody has removed.
+ */
+TEST(FIFOBuffMPMCTest, cap_one) {
+    FIFOBuff_MPMC<int>  fb(2);
+
+    ASSERT_TRUE(fb.add(1));
+    ASSERT_TRUE(fb.add(2));
+    ASSERT_FALSE(fb.add(3));
+
+    ASSERT_DEATH({
+        FIFOBuff_MPMC<int>  fb1(1);
+
+        // Not reached; what the assert guards against.
+        if (fb1.add(1) && fb1.add(2)) {
+            fprintf(stderr, "second add succeeded\n");
+        }
+    }, "cap\\(\\) >= 2");
+}
+
+/*
+ * Test move-only elements and cleanup of leftover elements.
+ */
+TEST(FIFOBuffMPMCTest, move_only) {
+    std::unique_ptr<int>    tmp;
+
+    FIFOBuff_MPMC<std::unique_ptr<int>, 16>     fb;
+
+    fb.add(std::unique_ptr<int>(new int(1)));
+    fb.emplace(new int(2));
+    fb.emplace(new int(3));
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(1, *tmp);
+}
+
+#define POISON          -13
+#define NUM_PRODUCERS   4
+#define NUM_CONSUMERS   10
+#define PRODUCTS        100000
+
+static int  check[PRODUCTS] = {0, };
+
+void* mpmc_producer(void *arg) {
+    FIFOBuff_MPMC<int>  *pfb = (FIFOBuff_MPMC<int>*)arg;
+    static int          next = 0;
+    int                 i;
+
+    // Producers share out [0, PRODUCTS) using an atomic counter.
+    while ((i = __sync_fetch_and_add(&next, 1)) < PRODUCTS) {
+        pfb->add_wait(i);
+    }
+
+    return nullptr;
+}
+
+void* mpmc_consumer(void *arg) {
+    FIFOBuff_MPMC<int>  *pfb = (FIFOBuff_MPMC<int>*)arg;
+    int                 i;
+
+    while (pfb->remove_wait(&i) == FIFO_OK && i != POISON) {
+        __sync_fetch_and_add(&check[i], 1);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Multiple producers and consumers; every element must be removed exactly once.
+ */
+TEST(FIFOBuffMPMCTest, threaded) {
+    pthread_t           producers[NUM_PRODUCERS];
+    pthread_t           consumers[NUM_CONSUMERS];
+    FIFOBuff_MPMC<int>  fb(CAP);
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_create(&consumers[i], nullptr, mpmc_consumer, (void*)&fb);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_create(&producers[i], nullptr, mpmc_producer, (void*)&fb);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], nullptr);
+    }
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        fb.add_wait(POISON);
+    }
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_join(consumers[i], nullptr);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i]);
+    }
+}
+
+static void *close_consumer(void *arg) {
+    FIFOBuff_MPMC<int>  *pfb = (FIFOBuff_MPMC<int>*)arg;
+    int                 i = 0;
+
+    while (pfb->remove_wait(&i) == FIFO_OK) {
+        __sync_fetch_and_add(&check[i], 1);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test timed waits, and that 'close()' releases parked consumers once the
+ * remaining elements are drained.
+ */
+TEST(FIFOBuffMPMCTest, close) {
+    pthread_t           consumers[NUM_CONSUMERS];
+    FIFOBuff_MPMC<int>  fb(CAP);
+    int                 tmp;
+
+    ASSERT_EQ(FIFO_TIMEOUT, fb.remove_wait_for(&tmp, std::chrono::milliseconds(5)));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(FIFO_OK, fb.add_wait(i));
+    }
+
+    ASSERT_EQ(FIFO_TIMEOUT, fb.add_wait_for(13, std::chrono::milliseconds(5)));
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        check[i] = 0;
+    }
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_create(&consumers[i], nullptr, close_consumer, (void*)&fb);
+    }
+
+    for (int i = CAP; i < PRODUCTS; i++) {
+        ASSERT_EQ(FIFO_OK, fb.add_wait(i));
+    }
+
+    // Give the consumers time to drain and park.
+    usleep(20000);
+    fb.close();
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_join(consumers[i], nullptr);
+    }
+
+    ASSERT_TRUE(fb.closed());
+    ASSERT_FALSE(fb.add(13));
+    ASSERT_EQ(FIFO_CLOSED, fb.add_wait(13));
+    ASSERT_EQ(FIFO_CLOSED, fb.remove_wait(&tmp));
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i]);
+    }
+}
@@ -0,0 +1,355 @@
+/*
+ * File: fifobuff_overwrite.hpp
+ *
+ * Provides a lock-free, fixed-sized ring buffer whose producer overwrites the
+ * oldest element when full instead of waiting for consumers.
+ *
+ */
+#ifndef __FIFOBUFF_OVERWRITE_HPP__
+#define __FIFOBUFF_OVERWRITE_HPP__
+
+#include <sched.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "fifobuff.hpp"
+
+/*
+ * Default wait policy of FIFOBuff_Overwrite's consumers: a short spin and a few
+ * yields before parking.
+ */
+#ifndef FIFOBUFF_OVERWRITE_SPIN
+#define FIFOBUFF_OVERWRITE_SPIN     64
+#endif
+
+#ifndef FIFOBUFF_OVERWRITE_YIELDS
+#define FIFOBUFF_OVERWRITE_YIELDS   64
+#endif
+
+/*
+ * Overwriting (Lossy) FIFO Buffer Class
+ *
+ * Thread-safe counterpart of 'FIFOBuff::add_overwrite()': keeps the most recent
+ * 'capacity()' elements, e.g. telemetry samples.  'add()' never fails and never
+ * waits for a consumer; when the ring is full it moves the head past the oldest
+ * element (counted by 'evicted()') and writes over it.
+ *
+ * Each slot carries a sequence number (a seqlock): odd while a producer is
+ * writing it, even and specific to the position once written.  A producer claims
+ * a position with an atomic add on the tail.  A consumer copies the element,
+ * checks the sequence number didn't change, then claims the position with a CAS
+ * on the head, so a copy torn by a producer lapping it is never returned.
+ * Because elements are copied while they may be overwritten, 'T' must be
+ * trivially copyable.
+ *
+ * Any number of threads may add and remove.  Producers never wait for consumers;
+ * a producer only waits if the producer a whole lap behind it, on the same slot,
+ * hasn't finished writing yet.  A consumer in 'remove_wait()' spins and yields as
+ * the FIFOWaitPolicy says, then parks until a producer publishes an element (see
+ * FIFOEventCount).  'close()' ends the stream: later adds are discarded, and
+ * consumers remove what's left and then get FIFO_CLOSED.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_Overwrite : private FIFOCap<N> {
+    static_assert(std::is_trivially_copyable<T>::value, "FIFOBuff_Overwrite elements must be trivially copyable");
+
+    typedef uint8_t item_mem_t[sizeof(T)];
+
+    struct cell_t {
+        std::atomic<size_t> seq;            // 2*pos+1 while writing 'pos', 2*pos+2 after.
+        item_mem_t          item;
+    };
+
+    // Set in 'tail' by 'close()'; a position claimed with it set is discarded.
+    static const size_t CLOSED_BIT = ~(~(size_t)0 >> 1);
+
+    cell_t                  *cells;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     tail;           // Positions claimed by producers so far.
+    std::atomic<size_t>     evict_cnt;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     head;           // Oldest position not yet removed or evicted.
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     close_pos;      // Positions claimed before 'close()', or ~0.
+    FIFOEventCount          items;          // Parks blocked consumers.
+
+    void init() {
+        cells = new cell_t[this->cap()];
+
+        for (size_t i = 0; i < this->cap(); i++) {
+            cells[i].seq.store(0, std::memory_order_relaxed);
+        }
+
+        tail.store(0, std::memory_order_relaxed);
+        evict_cnt.store(0, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        close_pos.store(~(size_t)0, std::memory_order_relaxed);
+        items.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_OVERWRITE_SPIN, FIFOBUFF_OVERWRITE_YIELDS));
+    }
+
+    /*
+     * Returns the end of the stream: positions claimed so far, less any claimed
+     * (and discarded) after 'close()'.
+     */
+    size_t end() const {
+        return std::min(tail.load(std::memory_order_acquire) & ~CLOSED_BIT,
+                        close_pos.load(std::memory_order_acquire));
+    }
+
+    /*
+     * Returns true if 'remove()' may succeed (or the FIFO is closed): the head's
+     * slot has been written.
+     */
+    bool remove_ready() const {
+        size_t  h = head.load(std::memory_order_acquire);
+
+        return closed() || cells[this->wrap(h)].seq.load(std::memory_order_acquire) == 2 * h + 2;
+    }
+
+    /*
+     * Called when a consumer found nothing to take from a closed FIFO.  A producer
+     * may have claimed a position before 'close()' but not written it yet.
+     *
+     * return: Returns true if no elements remain.
+     */
+    bool drained() const {
+        if (head.load(std::memory_order_acquire) >= close_pos.load(std::memory_order_acquire)) {
+            return true;
+        }
+
+        sched_yield();
+
+        return false;
+    }
+
+    static bool expired(FIFODeadline deadline) {
+        return deadline != FIFODeadline::max() && FIFOClock::now() >= deadline;
+    }
+
+    /*
+     * Moves the head up to 'oldest' unless consumers (or another producer)
+     * already have.
+     *
+     * return: Returns true if this call moved the head, i.e. evicted.
+     */
+    bool evict(size_t oldest) {
+        size_t  h = head.load(std::memory_order_relaxed);
+
+        while (h < oldest) {
+            if (head.compare_exchange_weak(h, oldest, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                evict_cnt.fetch_add(oldest - h, std::memory_order_relaxed);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_Overwrite() : FIFOCap<N>(N) {
+        init();
+    }
+
+    FIFOBuff_Overwrite(size_t max_cap) : FIFOCap<N>(max_cap) {
+        init();
+    }
+
+    ~FIFOBuff_Overwrite() {
+        delete [] cells;
+    }
+
+    size_t capacity() const {
+        return this->cap();
+    }
+
+    /*
+     * Returns the number of elements in the FIFO; only a snapshot.
+     */
+    size_t size() const {
+        size_t  h = head.load(std::memory_order_acquire);
+        size_t  t = end();
+
+        return t > h ? t - h : 0;
+    }
+
+    /*
+     * Returns the number of elements overwritten before being removed.
+     */
+    size_t evicted() const {
+        return evict_cnt.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.  Call before the FIFO is shared between threads.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        items.set_wait_policy(policy);
+    }
+
+    /*
+     * Adds an element, evicting the oldest one if the FIFO is full.  Any thread.
+     * Once the FIFO is closed, the element is discarded.
+     *
+     * return: Returns true if this call evicted an element (another producer may
+     *         have evicted it first).
+     */
+    bool add(const T &item) {
+        size_t      pos = tail.fetch_add(1, std::memory_order_acq_rel);
+        cell_t      &cell = cells[this->wrap(pos)];
+        size_t      prev = pos >= this->cap() ? 2 * (pos - this->cap()) + 2 : 0;
+        bool        evicted = false;
+        unsigned    spins = 0;
+
+        if (pos & CLOSED_BIT) {
+            return false;
+        }
+
+        // The head must be past the old element before its slot is touched.
+        if (pos >= this->cap()) {
+            evicted = evict(pos - this->cap() + 1);
+        }
+
+        // The producer a lap behind may not have finished writing this slot.
+        while (cell.seq.load(std::memory_order_acquire) != prev) {
+            if (spins < 64) {
+                fifo_cpu_relax();
+                spins++;
+            }
+            else {
+                sched_yield();
+            }
+        }
+
+        cell.seq.store(2 * pos + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(cell.item, &item, sizeof(T));
+        cell.seq.store(2 * pos + 2, std::memory_order_release);
+        items.notify();
+
+        return evicted;
+    }
+
+    /*
+     * Removes the oldest element.  Any thread.
+     *
+     * return: Returns false if FIFO is empty.
+     */
+    bool remove(T *pitem) {
+        size_t  h = head.load(std::memory_order_acquire);
+
+        for (;;) {
+            item_mem_t  copy;
+            cell_t      &cell = cells[this->wrap(h)];
+            size_t      seq;
+
+            if (h >= end()) {
+                return false;
+            }
+
+            seq = cell.seq.load(std::memory_order_acquire);
+            memcpy(copy, cell.item, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            /*
+             * If the slot no longer holds position 'h', a producer has lapped us
+             * and moved the head; the CAS is skipped and we start over from the
+             * new head.  If it doesn't hold it yet, the position is claimed but
+             * not written, and there's nothing to remove until it is.
+             */
+            if (seq == 2 * h + 2 && cell.seq.load(std::memory_order_relaxed) == seq) {
+                if (head.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    if (pitem != nullptr) {
+                        memcpy((void*)pitem, copy, sizeof(T));
+                    }
+
+                    return true;
+                }
+            }
+            else {
+                size_t  cur = head.load(std::memory_order_acquire);
+
+                if (cur == h && seq < 2 * h + 2) {
+                    return false;
+                }
+
+                h = cur;
+            }
+        }
+    }
+
+    /*
+     * Same as 'remove()'; waits for an element instead of failing.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and all of
+     *         its elements have been removed (or evicted).
+     */
+    FIFOStatus remove_wait(T *pitem) {
+        return remove_wait_until(pitem, FIFODeadline::max());
+    }
+
+    /*
+     * Same as 'remove_wait()', giving up at 'deadline'.
+     *
+     * return: Returns FIFO_OK if an element was removed, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and empty.
+     */
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline) {
+        unsigned    step = 0;
+
+        while (!remove(pitem)) {
+            if (closed()) {
+                if (drained()) {
+                    return FIFO_CLOSED;
+                }
+
+                continue;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            items.await(step, [this]() { return remove_ready(); }, deadline);
+        }
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus remove_wait_for(T *pitem, const std::chrono::duration<Rep, Period> &timeout) {
+        return remove_wait_until(pitem, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Same as FIFOBuff_MPMC: wakes all blocked consumers; adds are discarded from
+     * then on, and removes drain the remaining elements and then report
+     * FIFO_CLOSED.
+     */
+    void close() {
+        size_t  pos = tail.fetch_or(CLOSED_BIT, std::memory_order_acq_rel);
+
+        if (!(pos & CLOSED_BIT)) {
+            close_pos.store(pos, std::memory_order_release);
+        }
+
+        items.notify_all();
+    }
+
+    /*
+     * Returns true if 'close()' has been called.
+     */
+    bool closed() const {
+        return close_pos.load(std::memory_order_acquire) != ~(size_t)0;
+    }
+};
+
+#endif
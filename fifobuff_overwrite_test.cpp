@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include "gtest/gtest.h"
+#include "fifobuff_overwrite.hpp"
+
+#define CAP 10
+
+/*
+ * Test that the most recent elements are kept and the evicted ones counted.
+ */
+TEST(FIFOBuffOverwriteTest, add_remove) {
+    FIFOBuff_Overwrite<int> fb(CAP);
+    int                     tmp;
+
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_FALSE(fb.add(i));
+    }
+
+    ASSERT_EQ((size_t)CAP, fb.size());
+    ASSERT_EQ(0u, fb.evicted());
+
+    for (int i = CAP; i < 2*CAP + 3; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_EQ((size_t)CAP, fb.size());
+    ASSERT_EQ((size_t)CAP + 3, fb.evicted());
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(CAP + 3, tmp);
+
+    // Room for one more without evicting.
+    ASSERT_FALSE(fb.add(2*CAP + 3));
+    ASSERT_TRUE(fb.add(2*CAP + 4));
+    ASSERT_EQ((size_t)CAP + 4, fb.evicted());
+
+    for (int i = CAP + 5; i < 2*CAP + 5; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+#define CONSUMERS       3
+#define PRODUCTS        200000
+
+static FIFOBuff_Overwrite<int, 64>  ow_fifo;
+static std::atomic<int>             ow_check[PRODUCTS];
+static std::atomic<bool>            ow_done;
+static std::atomic<int>             ow_bad;
+
+static void *consumer(void *) {
+    int     last = -1;
+    int     tmp;
+
+    while (!ow_done.load() || ow_fifo.size() > 0) {
+        if (ow_fifo.remove(&tmp)) {
+            // Each consumer sees elements in order, with gaps.
+            if (tmp <= last) {
+                ow_bad++;
+            }
+
+            last = tmp;
+            ow_check[tmp]++;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test a producer that never waits against several slower consumers: every
+ * element is either removed once or evicted.
+ */
+TEST(FIFOBuffOverwriteTest, threaded) {
+    pthread_t   threads[CONSUMERS];
+    size_t      removed = 0;
+
+    ow_done = false;
+    ow_bad = 0;
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ow_check[i] = 0;
+    }
+
+    while (ow_fifo.remove(nullptr)) {
+    }
+
+    size_t  evicted = ow_fifo.evicted();
+
+    for (int i = 0; i < CONSUMERS; i++) {
+        pthread_create(&threads[i], nullptr, consumer, nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ow_fifo.add(i);
+    }
+
+    ow_done = true;
+
+    for (int i = 0; i < CONSUMERS; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_LE(ow_check[i].load(), 1);
+        removed += ow_check[i].load();
+    }
+
+    ASSERT_EQ(0, ow_bad.load());
+    ASSERT_EQ((size_t)PRODUCTS, removed + ow_fifo.evicted() - evicted);
+}
+
+#define PRODUCERS       3
+
+static std::atomic<int>             mp_last[CONSUMERS][PRODUCERS];
+
+static void *mp_producer(void *arg) {
+    int     p = (int)(intptr_t)arg;
+
+    for (int i = p; i < PRODUCTS; i += PRODUCERS) {
+        ow_fifo.add(i);
+    }
+
+    return nullptr;
+}
+
+static void *mp_consumer(void *arg) {
+    int     c = (int)(intptr_t)arg;
+    int     tmp;
+
+    while (!ow_done.load() || ow_fifo.size() > 0) {
+        if (ow_fifo.remove(&tmp)) {
+            // Each producer's elements come out in order, with gaps.
+            if (tmp <= mp_last[c][tmp % PRODUCERS]) {
+                ow_bad++;
+            }
+
+            mp_last[c][tmp % PRODUCERS] = tmp;
+            ow_check[tmp]++;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test several producers against several consumers: still every element is
+ * either removed once or evicted.
+ */
+TEST(FIFOBuffOverwriteTest, multi_producer) {
+    pthread_t   consumers[CONSUMERS];
+    pthread_t   producers[PRODUCERS];
+    size_t      removed = 0;
+
+    ow_done = false;
+    ow_bad = 0;
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ow_check[i] = 0;
+    }
+
+    while (ow_fifo.remove(nullptr)) {
+    }
+
+    size_t  evicted = ow_fifo.evicted();
+
+    for (int i = 0; i < CONSUMERS; i++) {
+        for (int p = 0; p < PRODUCERS; p++) {
+            mp_last[i][p] = -1;
+        }
+
+        pthread_create(&consumers[i], nullptr, mp_consumer, (void*)(intptr_t)i);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_create(&producers[p], nullptr, mp_producer, (void*)(intptr_t)p);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(producers[p], nullptr);
+    }
+
+    ow_done = true;
+
+    for (int i = 0; i < CONSUMERS; i++) {
+        pthread_join(consumers[i], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_LE(ow_check[i].load(), 1);
+        removed += ow_check[i].load();
+    }
+
+    ASSERT_EQ(0, ow_bad.load());
+    ASSERT_EQ((size_t)PRODUCTS, removed + ow_fifo.evicted() - evicted);
+}
+
+static FIFOBuff_Overwrite<int>  close_fifo(CAP);
+static int                      close_got;
+
+static void *close_consumer(void *) {
+    int     tmp;
+
+    while (close_fifo.remove_wait(&tmp) == FIFO_OK) {
+        close_got++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test timed waits, and that 'close()' releases a consumer parked on an idle
+ * ring once it has removed what's left.
+ */
+TEST(FIFOBuffOverwriteTest, close) {
+    pthread_t   thread;
+    int         tmp;
+
+    ASSERT_EQ(FIFO_TIMEOUT, close_fifo.remove_wait_for(&tmp, std::chrono::milliseconds(5)));
+
+    pthread_create(&thread, nullptr, close_consumer, nullptr);
+
+    for (int i = 0; i < CAP; i++) {
+        close_fifo.add(i);
+    }
+
+    // Let the consumer park on the empty ring before closing.
+    usleep(20000);
+    close_fifo.close();
+    pthread_join(thread, nullptr);
+
+    ASSERT_TRUE(close_fifo.closed());
+    ASSERT_EQ(CAP, close_got);
+
+    // Adds are discarded from now on.
+    ASSERT_FALSE(close_fifo.add(13));
+    ASSERT_EQ(0u, close_fifo.size());
+    ASSERT_FALSE(close_fifo.remove(&tmp));
+    ASSERT_EQ(FIFO_CLOSED, close_fifo.remove_wait(&tmp));
+}
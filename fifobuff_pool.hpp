@@ -0,0 +1,388 @@
+/*
+ * File: fifobuff_pool.hpp
+ *
+ * Provides a lock-free work-stealing deque and a thread pool built on it that
+ * uses a FIFOBuff_TS only for jobs submitted from outside the pool.
+ *
+ */
+#ifndef __FIFOBUFF_POOL_HPP__
+#define __FIFOBUFF_POOL_HPP__
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include "fifobuff.hpp"
+
+/*
+ * Work-Stealing Deque Class
+ *
+ * Fixed-sized Chase-Lev deque ("Correct and Efficient Work-Stealing for Weak
+ * Memory Models", Le et al.).  One owner thread pushes and pops at the bottom
+ * (LIFO, for cache locality) while any number of other threads steal from the
+ * top (FIFO, oldest first).  The owner only synchronizes with thieves when the
+ * deque is down to its last element; a steal is one CAS on 'top'.
+ *
+ * Elements are read while the owner may be overwriting their slot, so 'T' must be
+ * trivially copyable and fit in a lock-free atomic (e.g. a pointer).  Unlike the
+ * original algorithm the buffer doesn't grow: 'push()' fails when full, just like
+ * 'FIFOBuff::add()'.
+ *
+ * param T: type of element to store in deque.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_WS : private FIFOCap<N> {
+    static_assert(std::is_trivially_copyable<T>::value, "FIFOBuff_WS elements must be trivially copyable");
+
+    std::atomic<T>          *cells;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<int64_t>    top;
+
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<int64_t>    bottom;
+
+    void init() {
+        cells = new std::atomic<T>[this->cap()];
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<T> &cell(int64_t idx) {
+        return cells[this->wrap((size_t)idx)];
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_WS() : FIFOCap<N>(N) {
+        init();
+    }
+
+    FIFOBuff_WS(size_t max_cap) : FIFOCap<N>(max_cap) {
+        init();
+    }
+
+    ~FIFOBuff_WS() {
+        delete [] cells;
+    }
+
+    size_t capacity() const {
+        return this->cap();
+    }
+
+    /*
+     * Approximate number of elements; exact only when called by the owner with
+     * no steal in progress.
+     */
+    size_t size() const {
+        int64_t n = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+
+        return n > 0 ? (size_t)n : 0;
+    }
+
+    /*
+     * Adds an element to the bottom.  Owner only.
+     *
+     * return: Returns false if deque is full.
+     */
+    bool push(T item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+
+        if (b - t >= (int64_t)this->cap()) {
+            return false;
+        }
+
+        cell(b).store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /*
+     * Removes the most recently pushed element.  Owner only.
+     *
+     * return: Returns false if deque is empty (or the last element was stolen).
+     */
+    bool pop(T *pitem) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        int64_t t;
+        bool    got = true;
+
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+
+            return false;
+        }
+
+        *pitem = cell(b).load(std::memory_order_relaxed);
+
+        if (t == b) {
+            // Last element; race any thieves for it.
+            got = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        return got;
+    }
+
+    /*
+     * Removes the oldest element.  Any thread.
+     *
+     * return: Returns false if deque is empty or another thread won the race for
+     *         the element (the caller may retry).
+     */
+    bool steal(T *pitem) {
+        int64_t t = top.load(std::memory_order_acquire);
+        int64_t b;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;
+        }
+
+        *pitem = cell(t).load(std::memory_order_relaxed);
+
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Unit of work for FIFOPool.  Embed it in (or derive from it) the job's own
+ * state; 'run' is called with a pointer to it.  The pool never allocates or
+ * frees jobs.
+ */
+struct FIFOJob {
+    void    (*run)(FIFOJob *job);
+};
+
+/*
+ * Work-Stealing Thread Pool Class
+ *
+ * Each worker thread owns a FIFOBuff_WS of jobs.  Jobs submitted from a worker
+ * (e.g. by a running job) go on that worker's own deque without any lock, and it
+ * runs them newest first.  Jobs submitted from other threads go into a shared
+ * FIFOBuff_TS (the injection queue).  A worker out of local jobs takes one from
+ * the injection queue, then tries to steal the oldest job of another worker, and
+ * parks when there's nothing anywhere.
+ *
+ * Idle workers park on an event count: a submit only touches the shared counter
+ * when a worker is parked, and only one parked worker is woken at a time.
+ */
+class FIFOPool {
+    struct worker_t {
+        FIFOBuff_WS<FIFOJob*>   deque;
+        FIFOPool                *pool;
+        pthread_t               thread;
+        uint32_t                rng;
+
+        worker_t(size_t cap) : deque(cap) {}
+    };
+
+    FIFOBuff_TS<FIFOJob*>   inject;
+    std::vector<worker_t*>  workers;
+    FIFOParker              parker;
+    std::atomic<bool>       stopping;
+
+    /*
+     * Padded rather than 'alignas' so a FIFOPool may be allocated with plain
+     * 'new': whatever the alignment, these don't share a cache line with the
+     * members above or whatever follows the pool.
+     */
+    char                    pad0[FIFOBUFF_CACHE_LINE];
+    std::atomic<int32_t>    epoch;
+    std::atomic<int32_t>    parked;
+    std::atomic<bool>       waking;
+    char                    pad1[FIFOBUFF_CACHE_LINE];
+
+    /*
+     * The worker running on the calling thread, or null.
+     */
+    static worker_t *&current() {
+        static thread_local worker_t    *self = nullptr;
+
+        return self;
+    }
+
+    /*
+     * Wakes a parked worker, if any, after a job was queued.  Only one wake is
+     * outstanding at a time ('waking'); a burst of submits doesn't make a futex
+     * call each while the woken worker is still getting on a CPU.
+     */
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (parked.load(std::memory_order_relaxed) > 0 && !waking.exchange(true, std::memory_order_seq_cst)) {
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+            parker.wake(&epoch, 1);
+        }
+    }
+
+    /*
+     * Finds a job for 'self': local deque, then injection queue, then steal from
+     * the other workers starting at a random one.
+     */
+    bool find(worker_t *self, FIFOJob **pjob) {
+        size_t  n = workers.size();
+
+        if (self->deque.pop(pjob) || inject.remove(pjob)) {
+            return true;
+        }
+
+        // xorshift32
+        self->rng ^= self->rng << 13;
+        self->rng ^= self->rng >> 17;
+        self->rng ^= self->rng << 5;
+
+        for (size_t i = 0, v = self->rng % n; i < n; i++, v = (v + 1) % n) {
+            if (workers[v] != self && workers[v]->deque.steal(pjob)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void *worker(void *arg) {
+        worker_t    *self = static_cast<worker_t*>(arg);
+        FIFOPool    *pool = self->pool;
+        FIFOJob     *job;
+        bool        woken = false;
+
+        current() = self;
+
+        for (;;) {
+            if (pool->find(self, &job)) {
+                // A worker that was woken and found work passes the wake on.
+                if (woken) {
+                    pool->notify();
+                    woken = false;
+                }
+
+                job->run(job);
+                continue;
+            }
+
+            /*
+             * Announce we're about to park, then look again: a submit either sees
+             * 'parked' and bumps 'epoch' (so the wait returns at once), or queued
+             * its job before we looked.
+             */
+            pool->parked.fetch_add(1, std::memory_order_seq_cst);
+            int32_t seen = pool->epoch.load(std::memory_order_seq_cst);
+
+            woken = !pool->find(self, &job);
+
+            if (woken) {
+                if (pool->stopping.load(std::memory_order_acquire)) {
+                    pool->parked.fetch_sub(1, std::memory_order_relaxed);
+                    break;
+                }
+
+                pool->parker.wait(&pool->epoch, seen);
+            }
+
+            /*
+             * Whoever leaves the parked state clears 'waking' and then looks for
+             * work again, so a submit that skipped the wake isn't lost.
+             */
+            pool->parked.fetch_sub(1, std::memory_order_relaxed);
+            pool->waking.store(false, std::memory_order_seq_cst);
+
+            if (!woken) {
+                job->run(job);
+            }
+        }
+
+        current() = nullptr;
+
+        return nullptr;
+    }
+
+public:
+    /*
+     * Starts 'nthreads' workers.
+     *
+     * param inject_cap: capacity of the injection queue; external submits block
+     *                   while it's full.
+     * param deque_cap: capacity of each worker's deque.
+     */
+    FIFOPool(size_t nthreads, size_t inject_cap = 1024, size_t deque_cap = 1024) :
+            inject(inject_cap), workers(nthreads) {
+        stopping.store(false, std::memory_order_relaxed);
+        epoch.store(0, std::memory_order_relaxed);
+        parked.store(0, std::memory_order_relaxed);
+        waking.store(false, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < nthreads; i++) {
+            void    *mem = nullptr;
+
+            // worker_t is cache-line aligned, which plain 'new' doesn't guarantee before C++17.
+            if (posix_memalign(&mem, FIFOBUFF_CACHE_LINE, sizeof(worker_t)) != 0) {
+                throw std::bad_alloc();
+            }
+
+            workers[i] = new (mem) worker_t(deque_cap);
+            workers[i]->pool = this;
+            workers[i]->rng = 2654435761u * (uint32_t)(i + 1);
+        }
+
+        for (size_t i = 0; i < nthreads; i++) {
+            pthread_create(&workers[i]->thread, nullptr, worker, workers[i]);
+        }
+    }
+
+    /*
+     * Runs all submitted jobs (including any they submit) and joins the workers.
+     * Must not be called from a job.
+     */
+    ~FIFOPool() {
+        stopping.store(true, std::memory_order_release);
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        parker.wake(&epoch, INT32_MAX);
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            pthread_join(workers[i]->thread, nullptr);
+        }
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->~worker_t();
+            free(workers[i]);
+        }
+    }
+
+    size_t threads() const {
+        return workers.size();
+    }
+
+    /*
+     * Queues 'job' to be run by a worker.  From a job, it goes on the calling
+     * worker's own deque; if that's full, on the injection queue, and if that's
+     * full too, it's run right away (a worker must never block on the pool).
+     * From any other thread, it goes on the injection queue, blocking while it's
+     * full.
+     */
+    void submit(FIFOJob *job) {
+        worker_t    *self = current();
+
+        if (self == nullptr || self->pool != this) {
+            inject.add_wait(job);
+        }
+        else if (!self->deque.push(job) && !inject.add(job)) {
+            job->run(job);
+            return;
+        }
+
+        notify();
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include "gtest/gtest.h"
+#include "fifobuff_pool.hpp"
+
+#define CAP 10
+
+/*
+ * Test push/pop (LIFO) and steal (FIFO) from a single thread.
+ */
+TEST(FIFOBuffPoolTest, deque) {
+    FIFOBuff_WS<int>    dq(CAP);
+    int                 tmp;
+
+    ASSERT_FALSE(dq.pop(&tmp));
+    ASSERT_FALSE(dq.steal(&tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(dq.push(i));
+    }
+
+    ASSERT_FALSE(dq.push(13));
+    ASSERT_EQ((size_t)CAP, dq.size());
+
+    ASSERT_TRUE(dq.steal(&tmp));
+    ASSERT_EQ(0, tmp);
+    ASSERT_TRUE(dq.pop(&tmp));
+    ASSERT_EQ(CAP-1, tmp);
+
+    // Wrap around.
+    ASSERT_TRUE(dq.push(CAP));
+    ASSERT_TRUE(dq.push(CAP+1));
+    ASSERT_FALSE(dq.push(13));
+
+    ASSERT_TRUE(dq.pop(&tmp));
+    ASSERT_EQ(CAP+1, tmp);
+    ASSERT_TRUE(dq.pop(&tmp));
+    ASSERT_EQ(CAP, tmp);
+
+    for (int i = 1; i < CAP-1; i++) {
+        ASSERT_TRUE(dq.steal(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(dq.pop(&tmp));
+    ASSERT_FALSE(dq.steal(&tmp));
+}
+
+#define PRODUCTS        100000
+#define THIEVES         3
+
+static FIFOBuff_WS<int, 64> ws_deque;
+static std::atomic<int>     ws_check[PRODUCTS];
+static std::atomic<bool>    ws_done;
+
+static void *thief(void *) {
+    int     tmp;
+
+    while (!ws_done.load()) {
+        if (ws_deque.steal(&tmp)) {
+            ws_check[tmp]++;
+        }
+        else {
+            sched_yield();
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test that with the owner pushing and popping while other threads steal, every
+ * element is taken exactly once.
+ */
+TEST(FIFOBuffPoolTest, deque_threaded) {
+    pthread_t   threads[THIEVES];
+    int         tmp;
+
+    ws_done = false;
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ws_check[i] = 0;
+    }
+
+    for (int i = 0; i < THIEVES; i++) {
+        pthread_create(&threads[i], nullptr, thief, nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        while (!ws_deque.push(i)) {
+            sched_yield();
+        }
+
+        // Take back every other element ourselves.
+        if ((i & 1) && ws_deque.pop(&tmp)) {
+            ws_check[tmp]++;
+        }
+    }
+
+    while (ws_deque.pop(&tmp)) {
+        ws_check[tmp]++;
+    }
+
+    ws_done = true;
+
+    for (int i = 0; i < THIEVES; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, ws_check[i].load());
+    }
+}
+
+struct count_job : FIFOJob {
+    std::atomic<int>    *cnt;
+
+    static void run_count(FIFOJob *job) {
+        (*static_cast<count_job*>(job)->cnt)++;
+    }
+};
+
+/*
+ * Test jobs submitted from outside the pool, to a pool allocated with plain
+ * 'new' (which needs no more than the default alignment).
+ */
+TEST(FIFOBuffPoolTest, pool_submit) {
+    std::atomic<int>        cnt(0);
+    std::vector<count_job>  jobs(PRODUCTS);
+    FIFOPool                *pool = new FIFOPool(4, CAP);
+
+    ASSERT_LE(alignof(FIFOPool), alignof(std::max_align_t));
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        jobs[i].run = count_job::run_count;
+        jobs[i].cnt = &cnt;
+        pool->submit(&jobs[i]);
+    }
+
+    delete pool;
+
+    ASSERT_EQ(PRODUCTS, cnt.load());
+}
+
+#define TREE_DEPTH      14
+
+struct tree_job : FIFOJob {
+    FIFOPool            *pool;
+    std::atomic<int>    *cnt;
+    int                 depth;
+};
+
+static std::vector<tree_job>    tree_jobs;
+static std::atomic<int>         tree_next;
+
+static void run_tree(FIFOJob *job) {
+    tree_job    *tj = static_cast<tree_job*>(job);
+
+    (*tj->cnt)++;
+
+    if (tj->depth > 0) {
+        tree_job    *kids = &tree_jobs[tree_next.fetch_add(2)];
+
+        for (int i = 0; i < 2; i++) {
+            kids[i].run = run_tree;
+            kids[i].pool = tj->pool;
+            kids[i].cnt = tj->cnt;
+            kids[i].depth = tj->depth - 1;
+            tj->pool->submit(&kids[i]);
+        }
+    }
+}
+
+/*
+ * Test jobs that submit more jobs (a binary tree), which go on the workers' own
+ * deques and get stolen from there.  The small deques also force the overflow
+ * paths.
+ */
+TEST(FIFOBuffPoolTest, pool_spawn) {
+    std::atomic<int>    cnt(0);
+
+    tree_jobs.resize((2 << TREE_DEPTH) - 1);
+    tree_next = 1;
+
+    {
+        FIFOPool    pool(4, CAP, 4);
+
+        tree_jobs[0].run = run_tree;
+        tree_jobs[0].pool = &pool;
+        tree_jobs[0].cnt = &cnt;
+        tree_jobs[0].depth = TREE_DEPTH;
+        pool.submit(&tree_jobs[0]);
+    }
+
+    ASSERT_EQ((2 << TREE_DEPTH) - 1, cnt.load());
+}
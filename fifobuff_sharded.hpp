@@ -0,0 +1,408 @@
+/*
+ * File: fifobuff_sharded.hpp
+ *
+ * Provides a thread-safe FIFO buffer split into several independently locked
+ * lanes, trading strict FIFO order for scalability.
+ *
+ */
+#ifndef __FIFOBUFF_SHARDED_HPP__
+#define __FIFOBUFF_SHARDED_HPP__
+
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "fifobuff.hpp"
+
+/*
+ * Default wait policy of FIFOBuff_Sharded: a short spin and a few yields before
+ * parking.
+ */
+#ifndef FIFOBUFF_SHARDED_SPIN
+#define FIFOBUFF_SHARDED_SPIN   64
+#endif
+
+#ifndef FIFOBUFF_SHARDED_YIELDS
+#define FIFOBUFF_SHARDED_YIELDS 64
+#endif
+
+/*
+ * Sharded (Relaxed) FIFO Buffer Class
+ *
+ * Holds 'lanes' FIFOBuffs, each with its own lock on its own cache lines, so
+ * threads working on different lanes don't contend at all.  Each thread has a home
+ * lane (by thread index).  'add()' and 'remove()' try the home lane first, then go
+ * round the other lanes, skipping ones that are busy (locked by another thread) or
+ * can't be used (full/empty) before waiting for a lock.
+ *
+ * Each lane is strictly FIFO, so elements a thread adds to its home lane are
+ * removed in the order added.  Across lanes, order is only approximate: an element
+ * may be removed before an older one in another lane.  Use it for independent
+ * work items; use FIFOBuff_TS when global order matters.
+ *
+ * 'size()' is a sum of per-lane counts and only a snapshot.
+ *
+ * 'add_wait()'/'remove_wait()' block like FIFOBuff_TS's: they spin and yield as
+ * the FIFOWaitPolicy says, then park until an element is removed/added in any
+ * lane (see FIFOEventCount).  'close()' ends the stream as with FIFOBuff_TS.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity of each lane fixed at compile-time (must be a
+ *          power of two).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_Sharded {
+    /*
+     * Lanes are allocated separately; the padding keeps neighbouring allocations
+     * off the lane's cache lines.
+     */
+    struct lane_t {
+        pthread_mutex_t     mutex;
+        std::atomic<size_t> count;
+        FIFOBuff<T, N>      fifo;
+        uint8_t             pad[FIFOBUFF_CACHE_LINE];
+
+        lane_t(size_t cap) : count(0), fifo(cap) {
+            pthread_mutex_init(&mutex, nullptr);
+        }
+
+        ~lane_t() {
+            pthread_mutex_destroy(&mutex);
+        }
+    };
+
+    std::vector<lane_t*>    lanes;
+    size_t                  lane_cap;
+    std::atomic<bool>       is_closed;
+    FIFOEventCount          room;       // Parks blocked adds.
+    FIFOEventCount          items;      // Parks blocked removes.
+
+    void init(size_t nlanes, size_t cap) {
+        lane_cap = cap;
+        lanes.resize(nlanes);
+        is_closed.store(false, std::memory_order_relaxed);
+        room.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_SHARDED_SPIN, FIFOBUFF_SHARDED_YIELDS));
+        items.set_wait_policy(FIFOWaitPolicy(FIFOBUFF_SHARDED_SPIN, FIFOBUFF_SHARDED_YIELDS));
+
+        for (size_t i = 0; i < nlanes; i++) {
+            lanes[i] = new lane_t(cap);
+        }
+    }
+
+    /*
+     * Runs 'op' on the first lane it succeeds on, starting at the caller's home
+     * lane.  A first pass skips lanes that look unusable ('skip') or are locked;
+     * a second pass waits for each lock.
+     *
+     * return: Returns false if 'op' failed on every lane.
+     */
+    template <typename Skip, typename Op>
+    bool visit(Skip skip, Op op) {
+        size_t  n = lanes.size();
+        size_t  home = fifo_thread_index() % n;
+
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t i = 0, l = home; i < n; i++, l = (l + 1 == n) ? 0 : l + 1) {
+                lane_t  *lane = lanes[l];
+                bool    ok;
+
+                if (skip(lane)) {
+                    continue;
+                }
+
+                if (pass == 0 && l != home) {
+                    if (pthread_mutex_trylock(&lane->mutex) != 0) {
+                        continue;
+                    }
+                }
+                else {
+                    pthread_mutex_lock(&lane->mutex);
+                }
+
+                ok = op(lane);
+                pthread_mutex_unlock(&lane->mutex);
+
+                if (ok) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    /*
+     * Called when a consumer found nothing to take from a closed FIFO.  Taking
+     * each lane's lock waits out adds that got in before 'close()'.
+     *
+     * return: Returns true if no elements remain.
+     */
+    bool drained() {
+        for (size_t i = 0; i < lanes.size(); i++) {
+            size_t  sz;
+
+            pthread_mutex_lock(&lanes[i]->mutex);
+            sz = lanes[i]->fifo.size();
+            pthread_mutex_unlock(&lanes[i]->mutex);
+
+            if (sz > 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static bool expired(FIFODeadline deadline) {
+        return deadline != FIFODeadline::max() && FIFOClock::now() >= deadline;
+    }
+
+public:
+
+    /*
+     * Construct with 'nlanes' lanes of the compile-time capacity each.
+     */
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_Sharded(size_t nlanes) {
+        init(nlanes, N);
+    }
+
+    /*
+     * Construct with 'nlanes' lanes that can each contain a max of 'max_cap'
+     * elements.
+     */
+    FIFOBuff_Sharded(size_t nlanes, size_t max_cap) {
+        init(nlanes, max_cap);
+    }
+
+    ~FIFOBuff_Sharded() {
+        for (size_t i = 0; i < lanes.size(); i++) {
+            delete lanes[i];
+        }
+    }
+
+    size_t lane_count() const {
+        return lanes.size();
+    }
+
+    /*
+     * Returns max number of elements FIFO can hold (all lanes).
+     */
+    size_t capacity() const {
+        return lanes.size() * lane_cap;
+    }
+
+    size_t size() const {
+        size_t  sz = 0;
+
+        for (size_t i = 0; i < lanes.size(); i++) {
+            sz += lanes[i]->count.load(std::memory_order_relaxed);
+        }
+
+        return sz;
+    }
+
+    /*
+     * Same as FIFOBuff_TS.  Call before the FIFO is shared between threads.
+     */
+    void set_wait_policy(const FIFOWaitPolicy &policy) {
+        room.set_wait_policy(policy);
+        items.set_wait_policy(policy);
+    }
+
+    /*
+     * Same as FIFOBuff_TS, except the element goes in the first lane with room.
+     */
+    bool add(const T &item) {
+        return emplace(item);
+    }
+
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        size_t  cap = lane_cap;
+        bool    ok;
+
+        ok = visit(
+            [cap](lane_t *lane) {
+                return lane->count.load(std::memory_order_relaxed) >= cap;
+            },
+            [&](lane_t *lane) {
+                // Checked under the lane's lock; see 'close()'.
+                if (is_closed.load(std::memory_order_relaxed) || !lane->fifo.emplace(std::forward<Args>(args)...)) {
+                    return false;
+                }
+
+                lane->count.store(lane->fifo.size(), std::memory_order_relaxed);
+
+                return true;
+            });
+
+        if (ok) {
+            items.notify();
+        }
+
+        return ok;
+    }
+
+    /*
+     * Same as FIFOBuff_TS, except the element comes from the first lane with one.
+     */
+    bool remove(T *pitem) {
+        bool    ok;
+
+        ok = visit(
+            [](lane_t *lane) {
+                return lane->count.load(std::memory_order_relaxed) == 0;
+            },
+            [pitem](lane_t *lane) {
+                if (!lane->fifo.remove(pitem)) {
+                    return false;
+                }
+
+                lane->count.store(lane->fifo.size(), std::memory_order_relaxed);
+
+                return true;
+            });
+
+        if (ok) {
+            room.notify();
+        }
+
+        return ok;
+    }
+
+    /*
+     * Same as FIFOBuff_TS; blocks until some lane has room for the item.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait(const T &item) {
+        return emplace_wait_until(FIFODeadline::max(), item);
+    }
+
+    FIFOStatus add_wait(T &&item) {
+        return emplace_wait_until(FIFODeadline::max(), std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait(Args&&... args) {
+        return emplace_wait_until(FIFODeadline::max(), std::forward<Args>(args)...);
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if the element was added, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is (or gets) closed.
+     */
+    FIFOStatus add_wait_until(const T &item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, item);
+    }
+
+    FIFOStatus add_wait_until(T &&item, FIFODeadline deadline) {
+        return emplace_wait_until(deadline, std::move(item));
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(const T &item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, item);
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus add_wait_for(T &&item, const std::chrono::duration<Rep, Period> &timeout) {
+        return emplace_wait_until(FIFOClock::now() + timeout, std::move(item));
+    }
+
+    template <typename... Args>
+    FIFOStatus emplace_wait_until(FIFODeadline deadline, Args&&... args) {
+        unsigned    step = 0;
+
+        while (!emplace(std::forward<Args>(args)...)) {
+            if (closed()) {
+                return FIFO_CLOSED;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            room.await(step, [this]() { return closed() || size() < capacity(); }, deadline);
+        }
+
+        return FIFO_OK;
+    }
+
+    /*
+     * Same as FIFOBuff_TS; blocks until some lane has an element.
+     *
+     * return: Returns FIFO_OK, or FIFO_CLOSED if the FIFO is closed and all of
+     *         its elements have been removed.
+     */
+    FIFOStatus remove_wait(T *pitem) {
+        return remove_wait_until(pitem, FIFODeadline::max());
+    }
+
+    /*
+     * Same as FIFOBuff_TS.
+     *
+     * return: Returns FIFO_OK if an element was removed, FIFO_TIMEOUT if not, or
+     *         FIFO_CLOSED if the FIFO is closed and empty.
+     */
+    FIFOStatus remove_wait_until(T *pitem, FIFODeadline deadline) {
+        unsigned    step = 0;
+
+        while (!remove(pitem)) {
+            if (closed()) {
+                if (drained()) {
+                    return FIFO_CLOSED;
+                }
+
+                continue;
+            }
+
+            if (expired(deadline)) {
+                return FIFO_TIMEOUT;
+            }
+
+            items.await(step, [this]() { return closed() || size() > 0; }, deadline);
+        }
+
+        return FIFO_OK;
+    }
+
+    template <typename Rep, typename Period>
+    FIFOStatus remove_wait_for(T *pitem, const std::chrono::duration<Rep, Period> &timeout) {
+        return remove_wait_until(pitem, FIFOClock::now() + timeout);
+    }
+
+    /*
+     * Same as FIFOBuff_TS: wakes all blocked threads; adds fail from then on,
+     * removes drain the remaining elements and then report FIFO_CLOSED.
+     */
+    void close() {
+        is_closed.store(true, std::memory_order_seq_cst);
+
+        // An add already holding a lane's lock finishes before this returns.
+        for (size_t i = 0; i < lanes.size(); i++) {
+            pthread_mutex_lock(&lanes[i]->mutex);
+            pthread_mutex_unlock(&lanes[i]->mutex);
+        }
+
+        room.notify_all();
+        items.notify_all();
+    }
+
+    /*
+     * Returns true if 'close()' has been called.
+     */
+    bool closed() const {
+        return is_closed.load(std::memory_order_acquire);
+    }
+};
+
+#endif
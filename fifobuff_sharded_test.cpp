@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include "gtest/gtest.h"
+#include "fifobuff_sharded.hpp"
+
+#define CAP     10
+#define LANES   4
+
+/*
+ * Test add/remove from a single thread.  The thread's home lane fills first and
+ * is strictly FIFO; then the other lanes are used.
+ */
+TEST(FIFOBuffShardedTest, add_remove) {
+    FIFOBuff_Sharded<int>   fb(LANES, CAP);
+    int                     tmp;
+    int                     seen[LANES*CAP] = {0, };
+
+    ASSERT_EQ((size_t)LANES*CAP, fb.capacity());
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < LANES*CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+    ASSERT_EQ((size_t)LANES*CAP, fb.size());
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+        seen[tmp]++;
+    }
+
+    for (int i = CAP; i < LANES*CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        seen[tmp]++;
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+
+    for (int i = 0; i < LANES*CAP; i++) {
+        ASSERT_EQ(1, seen[i]);
+    }
+}
+
+#define PRODUCERS       4
+#define CONSUMERS       4
+#define PRODUCTS        100000
+
+static std::atomic<int>     check[PRODUCTS];
+static std::atomic<int>     taken;
+
+struct prod_arg {
+    FIFOBuff_Sharded<int>   *fb;
+    int                     first;
+};
+
+static void *producer(void *arg) {
+    prod_arg    *pa = static_cast<prod_arg*>(arg);
+
+    for (int i = pa->first; i < PRODUCTS; i += PRODUCERS) {
+        pa->fb->add_wait(i);
+    }
+
+    return nullptr;
+}
+
+static void *consumer(void *arg) {
+    FIFOBuff_Sharded<int>   *fb = static_cast<FIFOBuff_Sharded<int>*>(arg);
+    int                     tmp;
+
+    while (taken.load() < PRODUCTS) {
+        if (fb->remove(&tmp)) {
+            check[tmp]++;
+            taken++;
+        }
+        else {
+            sched_yield();
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test that with several producers and consumers every element is removed
+ * exactly once.
+ */
+TEST(FIFOBuffShardedTest, threaded) {
+    FIFOBuff_Sharded<int>   fb(LANES, 16);
+    pthread_t               threads[PRODUCERS + CONSUMERS];
+    prod_arg                args[PRODUCERS];
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        check[i] = 0;
+    }
+
+    taken = 0;
+
+    for (int c = 0; c < CONSUMERS; c++) {
+        pthread_create(&threads[c], nullptr, consumer, &fb);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        args[p].fb = &fb;
+        args[p].first = p;
+        pthread_create(&threads[CONSUMERS + p], nullptr, producer, &args[p]);
+    }
+
+    for (int t = 0; t < PRODUCERS + CONSUMERS; t++) {
+        pthread_join(threads[t], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i].load());
+    }
+
+    ASSERT_EQ(0u, fb.size());
+}
+
+static void *close_consumer(void *arg) {
+    FIFOBuff_Sharded<int>   *fb = static_cast<FIFOBuff_Sharded<int>*>(arg);
+    int                     tmp = 0;
+
+    while (fb->remove_wait(&tmp) == FIFO_OK) {
+        check[tmp]++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test blocking removes with timeouts, and that 'close()' releases consumers
+ * parked on any lane once everything is drained.
+ */
+TEST(FIFOBuffShardedTest, close) {
+    FIFOBuff_Sharded<int>   fb(LANES, 16);
+    pthread_t               threads[PRODUCERS + CONSUMERS];
+    prod_arg                args[PRODUCERS];
+    int                     tmp;
+
+    ASSERT_EQ(FIFO_TIMEOUT, fb.remove_wait_for(&tmp, std::chrono::milliseconds(5)));
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        check[i] = 0;
+    }
+
+    for (int c = 0; c < CONSUMERS; c++) {
+        pthread_create(&threads[c], nullptr, close_consumer, &fb);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        args[p].fb = &fb;
+        args[p].first = p;
+        pthread_create(&threads[CONSUMERS + p], nullptr, producer, &args[p]);
+    }
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        pthread_join(threads[CONSUMERS + p], nullptr);
+    }
+
+    fb.close();
+
+    for (int c = 0; c < CONSUMERS; c++) {
+        pthread_join(threads[c], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i].load());
+    }
+
+    ASSERT_TRUE(fb.closed());
+    ASSERT_FALSE(fb.add(13));
+    ASSERT_EQ(FIFO_CLOSED, fb.add_wait(13));
+    ASSERT_EQ(FIFO_CLOSED, fb.remove_wait(&tmp));
+
+    // A full FIFO times out instead.
+    FIFOBuff_Sharded<int>   full(2, 2);
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(FIFO_OK, full.add_wait(i));
+    }
+
+    ASSERT_EQ(FIFO_TIMEOUT, full.add_wait_for(13, std::chrono::milliseconds(5)));
+}
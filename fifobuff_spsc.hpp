@@ -0,0 +1,171 @@
+/*
+ * File: fifobuff_spsc.hpp
+ *
+ * Provides a lock-free, fixed-sized FIFO buffer for exactly one producer thread
+ * and one consumer thread.
+ *
+ */
+#ifndef __FIFOBUFF_SPSC_HPP__
+#define __FIFOBUFF_SPSC_HPP__
+
+#include <atomic>
+#include "fifobuff.hpp"
+
+/*
+ * Single-Producer/Single-Consumer FIFO Buffer Class
+ *
+ * Implements a wait-free FIFO buffer that is safe to use from one producer thread
+ * (calling 'add()'/'emplace()') and one consumer thread (calling 'remove()'/'peek()')
+ * at the same time, with no locks or semaphores.  The interface mirrors FIFOBuff so
+ * it can be dropped in for 1:1 thread handoffs.
+ *
+ * Head and tail are free-running counters published with acquire/release ordering.
+ * Each side keeps a cached copy of the other side's counter and only reloads it
+ * (pulling the other thread's cache line) when the cached value says the FIFO is
+ * full/empty.  Each side's data lives on its own cache line.
+ *
+ * param T: type of element to store in buffer.
+ * param N: if non-zero, the capacity fixed at compile-time (must be a power of two).
+ */
+template <typename T, size_t N = 0>
+class FIFOBuff_SPSC : private FIFOCap<N> {
+    typedef uint8_t item_mem_t[sizeof(T)];
+
+    item_mem_t              *buffer;
+    bool                    free_mem;
+
+    // Consumer side.
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     head;
+    size_t                  tail_cache;
+
+    // Producer side.
+    alignas(FIFOBUFF_CACHE_LINE)
+    std::atomic<size_t>     tail;
+    size_t                  head_cache;
+
+    T *slot(size_t idx) const {
+        return reinterpret_cast<T*>(buffer + this->wrap(idx));
+    }
+
+public:
+
+    template <size_t M = N, typename = typename std::enable_if<M != 0>::type>
+    FIFOBuff_SPSC() : FIFOCap<N>(N), free_mem(true), head(0), tail_cache(0), tail(0), head_cache(0) {
+        buffer = new item_mem_t[N];
+    }
+
+    /*
+     * Construct a FIFO buffer with a dynamically allocated buffer that can
+     * contain a max of 'max_cap' elements.
+     */
+    FIFOBuff_SPSC(size_t max_cap) : FIFOCap<N>(max_cap), free_mem(true), head(0), tail_cache(0), tail(0), head_cache(0) {
+        buffer = new item_mem_t[this->cap()];
+    }
+
+    /*
+     * Construct a FIFO buffer using memory provided by caller.
+     *
+     * param buf: Pointer to buffer memory of at least "sizeof(T) * max_cap" bytes.
+     * param max_cap: max number of elements FIFO can hold.
+     */
+    FIFOBuff_SPSC(void *buf, size_t max_cap) : FIFOCap<N>(max_cap), free_mem(false), head(0), tail_cache(0), tail(0), head_cache(0) {
+        buffer = reinterpret_cast<item_mem_t*>(buf);
+    }
+
+    ~FIFOBuff_SPSC() {
+        /*
+         * Cleanup any leftover elements.  Both threads must be done with the FIFO.
+         */
+        while (remove(nullptr)) {
+        }
+
+        if (free_mem) {
+            delete [] buffer;
+        }
+    }
+
+    /*
+     * Returns max number of elements FIFO can hold.
+     */
+    size_t capacity() const {
+        return this->cap();
+    }
+
+    /*
+     * Producer only.  Same as FIFOBuff.
+     */
+    bool add(const T &item) {
+        return emplace(item);
+    }
+
+    bool add(T &&item) {
+        return emplace(std::move(item));
+    }
+
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        size_t  t = tail.load(std::memory_order_relaxed);
+
+        if (t - head_cache == this->cap()) {
+            head_cache = head.load(std::memory_order_acquire);
+
+            if (t - head_cache == this->cap()) {
+                return false;
+            }
+        }
+
+        new (slot(t)) T(std::forward<Args>(args)...);
+        tail.store(t + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /*
+     * Consumer only.  Same as FIFOBuff.
+     */
+    bool remove(T *pitem) {
+        size_t  h = head.load(std::memory_order_relaxed);
+        T       *p;
+
+        if (h == tail_cache) {
+            tail_cache = tail.load(std::memory_order_acquire);
+
+            if (h == tail_cache) {
+                return false;
+            }
+        }
+
+        p = slot(h);
+
+        if (pitem != nullptr) {
+            *pitem = std::move(*p);
+        }
+
+        p->~T();
+        head.store(h + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /*
+     * Consumer only.  Same as FIFOBuff.
+     */
+    bool peek(T *pitem) {
+        size_t  h = head.load(std::memory_order_relaxed);
+
+        if (h == tail_cache) {
+            tail_cache = tail.load(std::memory_order_acquire);
+
+            if (h == tail_cache) {
+                return false;
+            }
+        }
+
+        *pitem = *slot(h);
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <memory>
+#include "gtest/gtest.h"
+#include "fifobuff_spsc.hpp"
+
+#define CAP 10
+
+/*
+ * Test add/remove/peek, including wrap-around, from a single thread.
+ */
+TEST(FIFOBuffSPSCTest, add_remove) {
+    FIFOBuff_SPSC<int>  fb(CAP);
+    int                 tmp;
+
+    ASSERT_FALSE(fb.remove(&tmp));
+    ASSERT_FALSE(fb.peek(&tmp));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+
+    for (int i = 0; i < CAP/2; i++) {
+        fb.remove(nullptr);
+    }
+
+    for (int i = 0; i < CAP/2; i++) {
+        ASSERT_TRUE(fb.add(CAP + i));
+    }
+
+    ASSERT_TRUE(fb.peek(&tmp));
+    ASSERT_EQ(CAP/2, tmp);
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i+CAP/2, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+/*
+ * Test leftover elements are destroyed with the FIFO.
+ */
+TEST(FIFOBuffSPSCTest, cleanup) {
+    std::shared_ptr<int>    p(new int(0));
+
+    {
+        FIFOBuff_SPSC<std::shared_ptr<int>, 16>     fb;
+
+        for (int i = 0; i < 5; i++) {
+            fb.add(p);
+        }
+
+        fb.remove(nullptr);
+        ASSERT_EQ(5, p.use_count());
+    }
+
+    ASSERT_EQ(1, p.use_count());
+}
+
+#define PRODUCTS    1000000
+
+void* spsc_consumer(void *arg) {
+    FIFOBuff_SPSC<int, 64>  *pfb = (FIFOBuff_SPSC<int, 64>*)arg;
+    int                     tmp;
+    long                    bad = 0;
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        while (!pfb->remove(&tmp)) {
+            sched_yield();
+        }
+
+        if (tmp != i) {
+            bad++;
+        }
+    }
+
+    return (void*)bad;
+}
+
+/*
+ * One producer and one consumer thread; every element must arrive in order.
+ */
+TEST(FIFOBuffSPSCTest, threaded) {
+    FIFOBuff_SPSC<int, 64>  fb;
+    pthread_t               thread;
+    void                    *bad;
+
+    pthread_create(&thread, nullptr, spsc_consumer, (void*)&fb);
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        while (!fb.add(i)) {
+            sched_yield();
+        }
+    }
+
+    pthread_join(thread, &bad);
+
+    ASSERT_EQ(0, (long)bad);
+    ASSERT_FALSE(fb.remove(nullptr));
+}
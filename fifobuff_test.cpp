@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <pthread.h>
+#include <poll.h>
 #include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include "gtest/gtest.h"
 #include "fifobuff.hpp"
 
@@ -11,7 +18,6 @@
  */
 TEST(FIFOBuffTest, add) {
     FIFOBuff<int>   fb(CAP);
-    int             tmp;
 
     for (int i = 0; i < CAP; i++) {
         ASSERT_TRUE(fb.add(i));
@@ -71,6 +77,191 @@ TEST(FIFOBuffTest, wrap) {
     }
 }
 
+/*
+ * Test peek returns the element at the front of the FIFO without removing it.
+ */
+TEST(FIFOBuffTest, peek) {
+    FIFOBuff<int>   fb(CAP);
+    int             tmp;
+
+    ASSERT_FALSE(fb.peek(&tmp));
+
+    fb.add(1);
+    fb.add(2);
+
+    ASSERT_TRUE(fb.peek(&tmp));
+    ASSERT_EQ(1, tmp);
+    ASSERT_EQ(2, fb.size());
+}
+
+#define FIXED_CAP 16
+
+/*
+ * Test wrap-around for a FIFO whose capacity is fixed at compile-time.
+ */
+TEST(FIFOBuffTest, fixed_cap) {
+    FIFOBuff<int, FIXED_CAP>    fb;
+    int                         tmp;
+
+    ASSERT_EQ(FIXED_CAP, fb.capacity());
+
+    for (int i = 0; i < FIXED_CAP; i++) {
+        ASSERT_TRUE(fb.add(i));
+    }
+
+    ASSERT_FALSE(fb.add(13));
+
+    for (int i = 0; i < FIXED_CAP/2; i++) {
+        fb.remove(nullptr);
+    }
+
+    for (int i = 0; i < FIXED_CAP/2; i++) {
+        ASSERT_TRUE(fb.add(FIXED_CAP + i));
+    }
+
+    for (int i = 0; i < FIXED_CAP; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i+FIXED_CAP/2, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(nullptr));
+
+    // A run-time capacity has to match the compile-time one, debug build or not.
+    ASSERT_THROW((FIFOBuff<int, FIXED_CAP>(FIXED_CAP/2)), std::invalid_argument);
+    ASSERT_THROW((FIFOBuff<int, FIXED_CAP>(&tmp, 1)), std::invalid_argument);
+    ASSERT_EQ(FIXED_CAP, (FIFOBuff<int, FIXED_CAP>(FIXED_CAP)).capacity());
+}
+
+/*
+ * Test bulk add/remove across the wrap point.
+ */
+TEST(FIFOBuffTest, bulk) {
+    FIFOBuff<int>   fb(CAP);
+    int             items[CAP + 5];
+    int             tmp[CAP + 5];
+
+    for (int i = 0; i < CAP + 5; i++) {
+        items[i] = i;
+    }
+
+    ASSERT_EQ(CAP/2, fb.add_n(items, CAP/2));
+    ASSERT_EQ(CAP/2 - 1, fb.remove_n(nullptr, CAP/2 - 1));
+
+    // Only room for CAP - 1 more; the copy wraps around the end of the buffer.
+    ASSERT_EQ(CAP - 1, fb.add_n(items + CAP/2, CAP + 5));
+    ASSERT_EQ(CAP, fb.remove_n(tmp, CAP + 5));
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(i + CAP/2 - 1, tmp[i]);
+    }
+
+    ASSERT_EQ(0, fb.remove_n(tmp, 1));
+}
+
+/*
+ * Test bulk add/remove of a non-trivially copyable type.
+ */
+TEST(FIFOBuffTest, bulk_string) {
+    FIFOBuff<std::string>   fb(CAP);
+    std::string             items[CAP];
+    std::string             tmp[CAP];
+
+    for (int i = 0; i < CAP; i++) {
+        items[i] = std::string(50, 'a' + i);
+    }
+
+    ASSERT_EQ(CAP - 2, fb.add_n(items, CAP - 2));
+    ASSERT_EQ(CAP/2, fb.remove_n(tmp, CAP/2));
+
+    // Wraps around the end of the buffer.
+    ASSERT_EQ(CAP/2, fb.add_n(items, CAP/2));
+    ASSERT_EQ(CAP - 2, fb.remove_n(tmp, CAP));
+
+    for (int i = 0; i < CAP/2 - 2; i++) {
+        ASSERT_EQ(items[CAP/2 + i], tmp[i]);
+    }
+
+    for (int i = 0; i < CAP/2; i++) {
+        ASSERT_EQ(items[i], tmp[CAP/2 - 2 + i]);
+    }
+}
+
+/*
+ * Test writing into and reading out of the FIFO buffer in place.
+ */
+TEST(FIFOBuffTest, prepare_commit) {
+    FIFOBuff<char>              fb(CAP);
+    FIFOBuff<char>::span_pair_t sp;
+    const char                  *msg = "0123456789";
+
+    // Move the head/tail to the middle of the buffer.
+    fb.add_n(msg, CAP/2);
+    fb.consume(CAP/2);
+
+    sp = fb.prepare(CAP + 1);
+    ASSERT_EQ(CAP, sp.size());
+    ASSERT_EQ(CAP/2, sp.first.len);
+    ASSERT_EQ(CAP/2, sp.second.len);
+
+    memcpy(sp.first.ptr, msg, sp.first.len);
+    memcpy(sp.second.ptr, msg + sp.first.len, 2);
+
+    // Nothing is added until commit.
+    ASSERT_EQ(0, fb.size());
+    fb.commit(CAP/2 + 2);
+    ASSERT_EQ(CAP/2 + 2, fb.size());
+
+    sp = fb.data();
+    ASSERT_EQ(CAP/2 + 2, sp.size());
+    ASSERT_EQ(0, memcmp(sp.first.ptr, msg, sp.first.len));
+    ASSERT_EQ(0, memcmp(sp.second.ptr, msg + sp.first.len, sp.second.len));
+
+    fb.consume(CAP/2 + 1);
+    sp = fb.data();
+    ASSERT_EQ(1, sp.size());
+    ASSERT_EQ(msg[CAP/2 + 1], sp.first.ptr[0]);
+    ASSERT_EQ(0, sp.second.len);
+}
+
+/*
+ * With mirrored storage, runs that wrap around the end of the buffer are
+ * contiguous in memory.
+ */
+TEST(FIFOBuffTest, mirrored) {
+    FIFOBuff<int>               fb(CAP, FIFO_MIRRORED);
+    FIFOBuff<int>::span_pair_t  sp;
+    size_t                      cap = fb.capacity();
+    int                         tmp;
+
+    ASSERT_TRUE(fb.mirrored());
+    ASSERT_EQ(0, cap * sizeof(int) % sysconf(_SC_PAGESIZE));
+    ASSERT_LE(CAP, cap);
+
+    // Leave one element just before the end of the buffer, then wrap.
+    for (size_t i = 0; i < cap - 1; i++) {
+        fb.add(-1);
+    }
+
+    fb.remove_n(nullptr, cap - 2);
+
+    for (int i = 0; i < CAP; i++) {
+        fb.add(i);
+    }
+
+    sp = fb.data();
+    ASSERT_EQ(CAP + 1, sp.first.len);
+    ASSERT_EQ(0, sp.second.len);
+    ASSERT_EQ(-1, sp.first.ptr[0]);
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(i, sp.first.ptr[i + 1]);
+    }
+
+    fb.remove(nullptr);
+    fb.remove(&tmp);
+    ASSERT_EQ(0, tmp);
+}
+
 class Dummy {
     public:
 
@@ -85,6 +276,12 @@ class Dummy {
             count++;
         }
 
+        Dummy &operator=(const Dummy &dum) {
+            inst = dum.inst;
+
+            return *this;
+        }
+
         ~Dummy() {
             count--;
         }
@@ -99,7 +296,6 @@ int Dummy::count = 0;
  */
 TEST(FIFOBuffTest, cleanup) {
     FIFOBuff<Dummy> *pfb;
-    int             tmp;
 
     pfb = new FIFOBuff<Dummy>(CAP);
 
@@ -122,6 +318,108 @@ TEST(FIFOBuffTest, cleanup) {
     ASSERT_EQ(0, Dummy::count);
 }
 
+/*
+ * Test that 'add_overwrite()' keeps the most recent elements and destroys the
+ * evicted ones.
+ */
+TEST(FIFOBuffTest, overwrite) {
+    Dummy::count = 0;
+
+    {
+        FIFOBuff<Dummy, 0, FIFOStats>   fb(CAP);
+
+        for (int i = 0; i < CAP; i++) {
+            ASSERT_FALSE(fb.add_overwrite(Dummy()));
+        }
+
+        for (int i = 0; i < CAP/2; i++) {
+            ASSERT_TRUE(fb.add_overwrite(Dummy()));
+        }
+
+        ASSERT_EQ((size_t)CAP, fb.size());
+        ASSERT_EQ((uint64_t)CAP/2, fb.stats().evicted);
+        ASSERT_EQ(CAP, Dummy::count);
+    }
+
+    ASSERT_EQ(0, Dummy::count);
+
+    FIFOBuff<int, 0, FIFOStats> fb(CAP);
+    int                         tmp;
+
+    for (int i = 0; i < CAP + 3; i++) {
+        fb.add_overwrite(i);
+    }
+
+    ASSERT_EQ(3u, fb.stats().evicted);
+
+    for (int i = 3; i < CAP + 3; i++) {
+        ASSERT_TRUE(fb.remove(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    ASSERT_FALSE(fb.remove(&tmp));
+}
+
+/*
+ * Move-only elements can be added, emplaced and removed.
+ */
+TEST(FIFOBuffTest, move_only) {
+    FIFOBuff<std::unique_ptr<int>>  fb(CAP);
+    std::unique_ptr<int>            tmp;
+
+    ASSERT_TRUE(fb.add(std::unique_ptr<int>(new int(1))));
+    ASSERT_TRUE(fb.emplace(new int(2)));
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(1, *tmp);
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(2, *tmp);
+}
+
+/*
+ * Elements are moved (not copied) in and out of the FIFO.
+ */
+TEST(FIFOBuffTest, move) {
+    FIFOBuff_TS<std::string>    fb(CAP);
+    std::string                 str(100, 'x');
+    const char                  *data = str.data();
+    std::string                 tmp;
+
+    fb.add_wait(std::move(str));
+    fb.emplace_wait(3, 'y');
+
+    fb.remove_wait(&tmp);
+    ASSERT_EQ(data, tmp.data());
+    fb.remove_wait(&tmp);
+    ASSERT_EQ("yyy", tmp);
+}
+
+/*
+ * Each FIFOBuff_TS has its own semaphores; queues don't share counts.
+ */
+TEST(FIFOBuffTest, ts_independent) {
+    FIFOBuff_TS<int>    fb1(CAP);
+    FIFOBuff_TS<int>    fb2(CAP/2);
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb1.add(i));
+    }
+
+    for (int i = 0; i < CAP/2; i++) {
+        ASSERT_TRUE(fb2.add(i));
+    }
+
+    ASSERT_FALSE(fb1.add(13));
+    ASSERT_FALSE(fb2.add(13));
+
+    for (int i = 0; i < CAP/2; i++) {
+        ASSERT_TRUE(fb2.remove(nullptr));
+    }
+
+    ASSERT_FALSE(fb2.remove(nullptr));
+    ASSERT_TRUE(fb1.remove(nullptr));
+}
+
 #define POISON          -13
 #define NUM_CONSUMERS   10
 #define PRODUCTS        100000
@@ -130,7 +428,7 @@ int     check[PRODUCTS] = {0, };
 
 void* consumer(void *arg) {
     FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
-    int                 i;
+    int                 i = POISON;
 
     // Keep consuming until "poison" value is read.
     do {
@@ -197,3 +495,659 @@ TEST(FIFOBuffTest, threaded) {
 
 
 
+void* spin_consumer(void *arg) {
+    FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
+    int                 i = -1;
+    long                bad = 0;
+
+    for (int n = 0; n < PRODUCTS; n++) {
+        pfb->remove_wait(&i);
+
+        if (i != n) {
+            bad++;
+        }
+    }
+
+    return (void*)bad;
+}
+
+/*
+ * Handoff between two threads with an adaptive spin-then-park wait policy.
+ */
+TEST(FIFOBuffTest, wait_policy) {
+    FIFOBuff_TS<int>    fb(CAP);
+    pthread_t           thread;
+    void                *bad;
+
+    fb.set_wait_policy(FIFOWaitPolicy(1000, 2, true));
+
+    pthread_create(&thread, nullptr, spin_consumer, (void*)&fb);
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        fb.add_wait(i);
+    }
+
+    pthread_join(thread, &bad);
+
+    ASSERT_EQ(0, (long)bad);
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+void* slow_producer(void *arg) {
+    FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
+
+    for (int i = 0; i < CAP; i++) {
+        usleep(1000);
+        pfb->add_wait(i);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test batched removal waits for 'min' elements or the deadline.
+ */
+TEST(FIFOBuffTest, remove_wait_bulk) {
+    FIFOBuff_TS<int>    fb(CAP);
+    pthread_t           thread;
+    int                 tmp[CAP];
+    size_t              cnt;
+
+    // Deadline passes with fewer than 'min' available; those are still removed.
+    fb.add(0);
+    fb.add(1);
+    cnt = fb.remove_wait_bulk(tmp, CAP, 3, FIFOClock::now() + std::chrono::milliseconds(10));
+    ASSERT_EQ(2, cnt);
+    ASSERT_EQ(0, tmp[0]);
+    ASSERT_EQ(1, tmp[1]);
+
+    // Nothing available at all.
+    ASSERT_EQ(0, fb.remove_wait_bulk(tmp, CAP, 1, FIFOClock::now() + std::chrono::milliseconds(1)));
+
+    // Wait (without a deadline) for elements trickling in from another thread.
+    pthread_create(&thread, nullptr, slow_producer, (void*)&fb);
+
+    cnt = fb.remove_wait_bulk(tmp, CAP, CAP/2);
+    ASSERT_LE(CAP/2, cnt);
+
+    for (size_t i = 0; i < cnt; i++) {
+        ASSERT_EQ(i, tmp[i]);
+    }
+
+    while (cnt < CAP) {
+        cnt += fb.remove_wait_bulk(tmp + cnt, CAP - cnt, CAP - cnt);
+    }
+
+    pthread_join(thread, nullptr);
+
+    ASSERT_EQ(CAP - 1, tmp[CAP - 1]);
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+#define BULK_PRODUCTS   10000
+#define BULK_BATCH      7
+
+void* bulk_consumer(void *arg) {
+    FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
+    int                 tmp[CAP];
+    long                bad = 0;
+
+    for (int n = 0; n < BULK_PRODUCTS; ) {
+        size_t  cnt = pfb->remove_wait_bulk(tmp, CAP, 1);
+
+        for (size_t i = 0; i < cnt; i++, n++) {
+            if (tmp[i] != n) {
+                bad++;
+            }
+        }
+    }
+
+    return (void*)bad;
+}
+
+/*
+ * Test batched adds, including batches larger than the capacity.
+ */
+TEST(FIFOBuffTest, add_bulk) {
+    FIFOBuff_TS<int>    fb(CAP);
+    pthread_t           thread;
+    int                 items[BULK_PRODUCTS];
+    void                *bad;
+
+    for (int i = 0; i < BULK_PRODUCTS; i++) {
+        items[i] = i;
+    }
+
+    // Only partially fits.
+    ASSERT_EQ(CAP/2, fb.try_add_bulk(items, CAP/2));
+    ASSERT_EQ(CAP/2, fb.try_add_bulk(items, CAP));
+    ASSERT_EQ(0, fb.try_add_bulk(items, 1));
+    ASSERT_EQ(CAP, fb.remove_wait_bulk(nullptr, CAP, CAP));
+
+    pthread_create(&thread, nullptr, bulk_consumer, (void*)&fb);
+
+    for (int i = 0; i < BULK_PRODUCTS - 2 * CAP; i += BULK_BATCH) {
+        fb.add_wait_bulk(items + i, std::min(BULK_BATCH, BULK_PRODUCTS - 2 * CAP - i));
+    }
+
+    fb.add_wait_bulk(items + BULK_PRODUCTS - 2 * CAP, 2 * CAP);
+
+    pthread_join(thread, &bad);
+
+    ASSERT_EQ(0, (long)bad);
+    ASSERT_FALSE(fb.remove(nullptr));
+}
+
+/*
+ * Test timed waits report timeouts separately from success.
+ */
+TEST(FIFOBuffTest, timed_wait) {
+    FIFOBuff_TS<int>    fb(CAP);
+    pthread_t           thread;
+    FIFODeadline        start;
+    int                 tmp;
+
+    start = FIFOClock::now();
+    ASSERT_EQ(FIFO_TIMEOUT, fb.remove_wait_for(&tmp, std::chrono::milliseconds(20)));
+    ASSERT_LE(start + std::chrono::milliseconds(20), FIFOClock::now());
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(FIFO_OK, fb.add_wait_for(i, std::chrono::milliseconds(20)));
+    }
+
+    ASSERT_EQ(FIFO_TIMEOUT, fb.add_wait_until(13, FIFOClock::now() + std::chrono::milliseconds(5)));
+    ASSERT_EQ(FIFO_OK, fb.remove_wait_until(&tmp, FIFOClock::now() + std::chrono::milliseconds(5)));
+    ASSERT_EQ(0, tmp);
+
+    while (fb.remove(nullptr)) {
+    }
+
+    // Elements arriving while waiting are removed before the deadline.
+    pthread_create(&thread, nullptr, slow_producer, (void*)&fb);
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_EQ(FIFO_OK, fb.remove_wait_for(&tmp, std::chrono::seconds(10)));
+        ASSERT_EQ(i, tmp);
+    }
+
+    pthread_join(thread, nullptr);
+}
+
+void* close_consumer(void *arg) {
+    FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
+    int                 i = 0;
+
+    // Keep consuming until end-of-stream.
+    while (pfb->remove_wait(&i) == FIFO_OK) {
+        __sync_fetch_and_add(&check[i], 1);
+    }
+
+    return nullptr;
+}
+
+void* close_producer(void *arg) {
+    FIFOBuff_TS<int>    *pfb = (FIFOBuff_TS<int>*)arg;
+
+    // Blocks once the FIFO fills; fails once it's closed.
+    while (pfb->add_wait(0) == FIFO_OK) {
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test shutting down with 'close()' instead of poison values.
+ */
+TEST(FIFOBuffTest, close) {
+    pthread_t           threads[NUM_CONSUMERS];
+    FIFOBuff_TS<int>    *pfb;
+    int                 tmp;
+
+    pfb = new FIFOBuff_TS<int>(CAP);
+    memset(check, 0, sizeof(check));
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_create(&threads[i], nullptr, close_consumer, (void*)pfb);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(FIFO_OK, pfb->add_wait(i));
+    }
+
+    pfb->close();
+
+    ASSERT_TRUE(pfb->closed());
+    ASSERT_EQ(FIFO_CLOSED, pfb->add_wait(13));
+    ASSERT_FALSE(pfb->add(13));
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i]);
+    }
+
+    ASSERT_EQ(FIFO_CLOSED, pfb->remove_wait(&tmp));
+    ASSERT_EQ(0, pfb->remove_wait_bulk(nullptr, CAP, CAP));
+
+    delete pfb;
+}
+
+/*
+ * Test 'close()' wakes a producer blocked on a full FIFO, and the elements added
+ * before the close can still be removed.
+ */
+TEST(FIFOBuffTest, close_blocked_add) {
+    FIFOBuff_TS<int>    fb(CAP);
+    pthread_t           thread;
+    int                 cnt = 0;
+
+    pthread_create(&thread, nullptr, close_producer, (void*)&fb);
+
+    // Give the producer time to fill the FIFO and block.
+    usleep(10000);
+    fb.close();
+    pthread_join(thread, nullptr);
+
+    while (fb.remove_wait(nullptr) == FIFO_OK) {
+        cnt++;
+    }
+
+    ASSERT_EQ(CAP, cnt);
+}
+
+/*
+ * Returns true if the eventfd is readable and resets it.
+ */
+static bool event_ready(int fd) {
+    struct pollfd   pfd = { fd, POLLIN, 0 };
+    uint64_t        val;
+
+    if (poll(&pfd, 1, 0) != 1) {
+        return false;
+    }
+
+    return read(fd, &val, sizeof(val)) == sizeof(val);
+}
+
+/*
+ * Test that the eventfd is signaled on the empty to non-empty transition only.
+ */
+TEST(FIFOBuffTest, event_fd) {
+    FIFOBuff_TS<int>    fb(CAP);
+    int                 fd = fb.enable_event_fd();
+    int                 items[] = {3, 4};
+    int                 tmp;
+
+    ASSERT_GE(fd, 0);
+    ASSERT_FALSE(event_ready(fd));
+
+    ASSERT_TRUE(fb.add(1));
+    ASSERT_TRUE(event_ready(fd));
+
+    // Adds to a non-empty FIFO are coalesced.
+    ASSERT_TRUE(fb.add(2));
+    ASSERT_EQ(2u, fb.try_add_bulk(items, 2));
+    ASSERT_FALSE(event_ready(fd));
+
+    while (fb.remove(&tmp));
+
+    ASSERT_EQ(1u, fb.try_add_bulk(items, 1));
+    ASSERT_TRUE(event_ready(fd));
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(3, tmp);
+
+    fb.close();
+    ASSERT_TRUE(event_ready(fd));
+}
+
+/*
+ * Test that the eventfd is also signaled when the watermark is reached.
+ */
+TEST(FIFOBuffTest, event_fd_watermark) {
+    FIFOBuff_TS<int>    fb(CAP);
+    int                 fd = fb.enable_event_fd(3);
+
+    ASSERT_TRUE(fb.add(1));
+    ASSERT_TRUE(event_ready(fd));
+
+    ASSERT_TRUE(fb.add(2));
+    ASSERT_FALSE(event_ready(fd));
+
+    ASSERT_TRUE(fb.add(3));
+    ASSERT_TRUE(event_ready(fd));
+
+    ASSERT_TRUE(fb.add(4));
+    ASSERT_FALSE(event_ready(fd));
+}
+
+#define FC_THREADS      4
+
+typedef FIFOBuff_TS<int, 0, FIFOCombiner>   FIFOBuff_FC;
+
+static int  fc_next;
+
+static void *fc_producer(void *arg) {
+    FIFOBuff_FC *pfb = (FIFOBuff_FC*)arg;
+    int         i;
+
+    while ((i = __sync_fetch_and_add(&fc_next, 1)) < PRODUCTS) {
+        pfb->add_wait(i);
+    }
+
+    return nullptr;
+}
+
+static void *fc_consumer(void *arg) {
+    FIFOBuff_FC *pfb = (FIFOBuff_FC*)arg;
+    int         i;
+
+    while (pfb->remove_wait(&i) == FIFO_OK) {
+        check[i]++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test the flat-combining policy with several producers and consumers.
+ */
+TEST(FIFOBuffTest, combining) {
+    FIFOBuff_FC fb(CAP);
+    pthread_t   threads[2*FC_THREADS];
+    int         tmp;
+
+    memset(check, 0, sizeof(check));
+    fc_next = 0;
+
+    ASSERT_TRUE(fb.add(1));
+    ASSERT_TRUE(fb.peek(&tmp));
+    ASSERT_EQ(1, tmp);
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_FALSE(fb.remove(&tmp));
+
+    for (int i = 0; i < FC_THREADS; i++) {
+        pthread_create(&threads[i], nullptr, fc_consumer, &fb);
+        pthread_create(&threads[FC_THREADS + i], nullptr, fc_producer, &fb);
+    }
+
+    for (int i = 0; i < FC_THREADS; i++) {
+        pthread_join(threads[FC_THREADS + i], nullptr);
+    }
+
+    fb.close();
+
+    for (int i = 0; i < FC_THREADS; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+
+    for (int i = 0; i < PRODUCTS; i++) {
+        ASSERT_EQ(1, check[i]);
+    }
+}
+
+typedef FIFOBuff_TS<int, 0, FIFOMutex, FIFOStats>   FIFOBuff_Stats;
+
+static void *stats_producer(void *arg) {
+    FIFOBuff_Stats  *pfb = static_cast<FIFOBuff_Stats*>(arg);
+
+    usleep(20000);
+    pfb->add_wait(1);
+
+    return nullptr;
+}
+
+/*
+ * Test the FIFOStats counters, and that without them the hooks cost no space.
+ */
+TEST(FIFOBuffTest, stats) {
+    FIFOBuff<int, 0, FIFOStats> fb(CAP);
+    FIFOBuff_Stats              fbts(CAP);
+    FIFOStatsData               st;
+    int                         items[CAP] = {0, };
+    int                         tmp;
+    pthread_t                   thread;
+
+    ASSERT_EQ(sizeof(FIFOBuff<int>), sizeof(FIFOBuff<int, 0, FIFONoStats>));
+    ASSERT_LT(sizeof(FIFOBuff<int>), sizeof(FIFOBuff<int, 0, FIFOStats>));
+    ASSERT_EQ(0u, FIFOBuff<int>(CAP).stats().adds);
+
+    ASSERT_FALSE(fb.remove(&tmp));
+    ASSERT_EQ((size_t)CAP - 2, fb.add_n(items, CAP - 2));
+
+    for (int i = 0; i < 3; i++) {
+        fb.add(i);
+    }
+
+    ASSERT_TRUE(fb.remove(&tmp));
+    ASSERT_EQ(2u, fb.remove_n(nullptr, 2));
+
+    st = fb.stats();
+    ASSERT_EQ((uint64_t)CAP, st.adds);
+    ASSERT_EQ(3u, st.removes);
+    ASSERT_EQ(1u, st.full);
+    ASSERT_EQ(1u, st.empty);
+    ASSERT_EQ((uint64_t)CAP, st.high_water);
+
+    fb.reset_stats();
+    ASSERT_EQ(0u, fb.stats().adds);
+
+    // Thread-safe version, including time blocked waiting for an element.
+    ASSERT_FALSE(fbts.remove(&tmp));
+    ASSERT_EQ((size_t)CAP, fbts.try_add_bulk(items, CAP));
+    ASSERT_FALSE(fbts.add(13));
+    ASSERT_EQ((size_t)CAP, fbts.remove_wait_bulk(nullptr, CAP, CAP));
+
+    pthread_create(&thread, nullptr, stats_producer, &fbts);
+    ASSERT_EQ(FIFO_OK, fbts.remove_wait(&tmp));
+    pthread_join(thread, nullptr);
+
+    st = fbts.stats();
+    ASSERT_EQ((uint64_t)CAP + 1, st.adds);
+    ASSERT_EQ((uint64_t)CAP + 1, st.removes);
+    ASSERT_EQ(1u, st.full);
+    ASSERT_EQ(1u, st.empty);
+    ASSERT_EQ((uint64_t)CAP, st.high_water);
+    ASSERT_EQ(0u, st.add_blocks);
+    ASSERT_EQ(1u, st.remove_blocks);
+    ASSERT_GE(st.remove_blocked_ns, 10000000u);
+}
+
+/*
+ * Test each overflow policy on a full FIFO, and that the default still blocks.
+ */
+TEST(FIFOBuffTest, overflow) {
+    FIFOBuff_TS<int>                                                fb_block(CAP);
+    FIFOBuff_TS<int, 0, FIFOMutex, FIFONoStats, FIFORejectNewest>   fb_reject(CAP);
+    FIFOBuff_TS<int, 0, FIFOMutex, FIFONoStats, FIFODropOldest>     fb_oldest(CAP);
+    FIFOBuff_TS<int, 0, FIFOMutex, FIFONoStats, FIFOSampleDrop<4, 50> > fb_sample(CAP);
+    FIFOBuff_TS<int, 0, FIFOMutex, FIFONoStats, FIFOSpill<FIFOBuff_TS<int> > > fb_spill(CAP);
+    FIFOBuff_TS<int>                                                fb_slow(2);
+    int                                                             items[3] = {20, 21, 22};
+    int                                                             kept = 0;
+    int                                                             tmp;
+
+    for (int i = 0; i < CAP; i++) {
+        ASSERT_TRUE(fb_block.add(i));
+        ASSERT_TRUE(fb_reject.add(i));
+        ASSERT_TRUE(fb_oldest.add(i));
+    }
+
+    ASSERT_FALSE(fb_block.add(CAP));
+    ASSERT_EQ(FIFO_TIMEOUT, fb_block.add_wait_for(CAP, std::chrono::milliseconds(1)));
+    ASSERT_EQ(0u, fb_block.dropped());
+
+    // Reject newest: the FIFO is left as it was.
+    ASSERT_FALSE(fb_reject.add(CAP));
+    ASSERT_EQ(FIFO_DROPPED, fb_reject.add_wait(CAP));
+    ASSERT_EQ(0u, fb_reject.add_wait_bulk(items, 3));
+    ASSERT_EQ(5u, fb_reject.dropped());
+    ASSERT_TRUE(fb_reject.remove(&tmp));
+    ASSERT_EQ(0, tmp);
+
+    // Drop oldest: the most recent elements are kept.
+    ASSERT_TRUE(fb_oldest.add(CAP));
+    ASSERT_EQ(FIFO_OK, fb_oldest.add_wait(CAP + 1));
+    ASSERT_EQ(3u, fb_oldest.try_add_bulk(items, 3));
+    ASSERT_EQ(5u, fb_oldest.dropped());
+
+    for (int i = 5; i < CAP + 2; i++) {
+        ASSERT_EQ(FIFO_OK, fb_oldest.remove_wait(&tmp));
+        ASSERT_EQ(i, tmp);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(fb_oldest.remove(&tmp));
+        ASSERT_EQ(items[i], tmp);
+    }
+
+    ASSERT_FALSE(fb_oldest.remove(&tmp));
+
+    // Sample: everything up to half full, then one in four of the other 15.
+    for (int i = 0; i < 2 * CAP; i++) {
+        kept += fb_sample.add(i);
+    }
+
+    ASSERT_EQ(CAP / 2 + 4, kept);
+    ASSERT_EQ((size_t)2 * CAP - kept, fb_sample.dropped());
+
+    // Spill: overflow goes to the secondary FIFO until it's full too.
+    fb_spill.overflow_policy().set_target(&fb_slow);
+
+    for (int i = 0; i < CAP + 3; i++) {
+        fb_spill.add(i);
+    }
+
+    ASSERT_EQ(2u, fb_spill.spilled());
+    ASSERT_EQ(1u, fb_spill.dropped());
+    ASSERT_TRUE(fb_slow.remove(&tmp));
+    ASSERT_EQ(CAP, tmp);
+
+    fb_spill.close();
+    ASSERT_EQ(FIFO_CLOSED, fb_spill.add_wait(0));
+}
+
+#define OVF_PRODUCTS    100000
+
+static FIFOBuff_TS<int, 16, FIFOMutex, FIFONoStats, FIFODropOldest>   ovf_fifo;
+static std::atomic<int>                                             ovf_removed;
+
+static void *ovf_consumer(void *arg) {
+    int     last = -1;
+    int     tmp = 0;
+
+    (void)arg;
+
+    while (ovf_fifo.remove_wait(&tmp) == FIFO_OK) {
+        // Order is kept, with gaps.
+        if (tmp <= last) {
+            break;
+        }
+
+        last = tmp;
+        ovf_removed++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test that a producer never waits with FIFODropOldest, and every element is
+ * either removed or counted as dropped.
+ */
+TEST(FIFOBuffTest, overflow_threaded) {
+    pthread_t   thread;
+    int         tmp;
+
+    ovf_removed = 0;
+    pthread_create(&thread, nullptr, ovf_consumer, nullptr);
+
+    for (int i = 0; i < OVF_PRODUCTS; i++) {
+        ASSERT_EQ(FIFO_OK, ovf_fifo.add_wait(i));
+    }
+
+    ovf_fifo.close();
+    pthread_join(thread, nullptr);
+
+    ASSERT_FALSE(ovf_fifo.remove(&tmp));
+    ASSERT_EQ((size_t)OVF_PRODUCTS, ovf_removed.load() + ovf_fifo.dropped());
+}
+
+#define OVF_THREADS     3
+
+static FIFOBuff_TS<int, 2, FIFOMutex, FIFONoStats, FIFODropOldest>    ovf_small;
+static std::atomic<int>                                             ovf_check[OVF_PRODUCTS];
+static std::atomic<bool>                                            ovf_done;
+
+static void *ovf_producer(void *arg) {
+    int     p = (int)(intptr_t)arg;
+
+    for (int i = p; i < OVF_PRODUCTS; i += OVF_THREADS) {
+        if (!ovf_small.add(i)) {
+            ovf_check[i] = -1000;
+        }
+    }
+
+    return nullptr;
+}
+
+static void *ovf_remover(void *arg) {
+    int     tmp = 0;
+
+    (void)arg;
+
+    for (;;) {
+        // Read first: once set, a remove that finds nothing means it's all gone.
+        bool    done = ovf_done.load();
+
+        if (ovf_small.remove(&tmp)) {
+            ovf_check[tmp]++;
+        }
+        else if (done) {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Test FIFODropOldest with several producers and removers on a tiny FIFO, so that
+ * adds often find no room while a remove is still handing its slot back.  Adds
+ * never fail, and every element is either removed once or counted as dropped.
+ */
+TEST(FIFOBuffTest, overflow_contended) {
+    pthread_t   producers[OVF_THREADS];
+    pthread_t   removers[OVF_THREADS];
+    size_t      removed = 0;
+
+    ovf_done = false;
+
+    for (int i = 0; i < OVF_PRODUCTS; i++) {
+        ovf_check[i] = 0;
+    }
+
+    for (int i = 0; i < OVF_THREADS; i++) {
+        pthread_create(&removers[i], nullptr, ovf_remover, nullptr);
+        pthread_create(&producers[i], nullptr, ovf_producer, (void*)(intptr_t)i);
+    }
+
+    for (int i = 0; i < OVF_THREADS; i++) {
+        pthread_join(producers[i], nullptr);
+    }
+
+    ovf_done = true;
+
+    for (int i = 0; i < OVF_THREADS; i++) {
+        pthread_join(removers[i], nullptr);
+    }
+
+    for (int i = 0; i < OVF_PRODUCTS; i++) {
+        ASSERT_GE(ovf_check[i].load(), 0);
+        ASSERT_LE(ovf_check[i].load(), 1);
+        removed += ovf_check[i].load();
+    }
+
+    ASSERT_EQ((size_t)OVF_PRODUCTS, removed + ovf_small.dropped());
+}